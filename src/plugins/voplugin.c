@@ -9,7 +9,6 @@
 #include <string.h>
 #include <dlfcn.h>
 #include <unistd.h>
-#include <sys/mman.h>
 
 #include "../vohttpd.h"
 
@@ -28,23 +27,12 @@ char *memstr(char *src, int size, const char *key)
 
 int plugin_json_status(socket_data *d, const char *status)
 {
-    char head[MESSAGE_SIZE], buf[MESSAGE_SIZE];
-    int size, total = 0;
-
-    total += snprintf(buf + total, MESSAGE_SIZE - total, "{\"status\":\"%s\"}", status);
-    size = vohttpd_reply_head(head, 200);
-    size += snprintf(head + size, MESSAGE_SIZE, "%s: %s\r\n", HTTP_CONTENT_TYPE, vohttpd_mime_map("json"));
-    size += snprintf(head + size, MESSAGE_SIZE, "%s: %s\r\n", HTTP_DATE_TIME, vohttpd_gmtime());
-    size += snprintf(head + size, MESSAGE_SIZE, "%s: %d\r\n", HTTP_CONTENT_LENGTH, total);
-    strcat(head + size, "\r\n"); size += 2;
-
-    size = d->set->send(d->sock, head, size, 0);
-    if(size <= 0)
-        return -1;
-    size = d->set->send(d->sock, buf, total, 0);
-    if(size <= 0)
-        return -1;
-    return 0;
+    http_response r;
+
+    vohttpd_response_init(&r, d, 200);
+    vohttpd_response_header(&r, HTTP_CONTENT_TYPE, vohttpd_mime_map("json"));
+    vohttpd_response_printf(&r, "{\"status\":\"%s\"}", status);
+    return vohttpd_response_send(&r) < 0 ? -1 : 0;
 }
 
 /* plugins returned json format:
@@ -58,52 +46,41 @@ int plugin_json_status(socket_data *d, const char *status)
  */
 int plugin_list(socket_data *d, string_reference *pa)
 {
-    char head[MESSAGE_SIZE], buf[SENDBUF_SIZE];
-    int size = 0, total = 0, i;
+    const char *split = "";
+    http_response r;
+    uint i;
 
     vohttpd_unused(pa);
-    total += snprintf(buf + total, SENDBUF_SIZE - total, "{\"status\":\"success\",\"plugins\":[");
+    vohttpd_response_init(&r, d, 200);
+    vohttpd_response_header(&r, HTTP_CONTENT_TYPE, vohttpd_mime_map("json"));
+    vohttpd_response_printf(&r, "{\"status\":\"success\",\"plugins\":[");
     for(i = 0; i < d->set->funcs->max; i++) {
-        int pos = i * d->set->funcs->unit, code;
-        char *key = string_hash_key(d->set->funcs, pos);
-        void *h = (void *)string_hash_val(d->set->funcs, pos);
+        int code;
+        char *key = func_table_key(d->set->funcs, i);
+        void *h = func_table_val(d->set->funcs, i);
         _plugin_query query;
         plugin_info   info;
 
         if(strchr(key, '.') == NULL)
             continue;
 
-        total += snprintf(buf + total, SENDBUF_SIZE - total, "{\"name\":\"%s\",", key);
+        vohttpd_response_printf(&r, "%s{\"name\":\"%s\",", split, key);
+        split = ",";
         query = dlsym(h, LIBRARY_QUERY);
         if(query == NULL) {
-            total += snprintf(buf + total, SENDBUF_SIZE - total, "\"status\":\"no query interface\"}");
+            vohttpd_response_printf(&r, "\"status\":\"no query interface\"}");
             continue;
         }
         if(code = query(0, &info), code < 0) {
-            total += snprintf(buf + total, SENDBUF_SIZE - total, "\"status\":\"error %d\"}", code);
+            vohttpd_response_printf(&r, "\"status\":\"error %d\"}", code);
             continue;
         }
 
-        total += snprintf(buf + total, SENDBUF_SIZE - total, "\"note\":\"%s\",", info.note);
-        total += snprintf(buf + total, SENDBUF_SIZE - total, "\"status\":\"loaded\"},");
+        vohttpd_response_printf(&r, "\"note\":\"%s\",", info.note);
+        vohttpd_response_printf(&r, "\"status\":\"loaded\"}");
     }
-    buf[--total] = '\0';   // remove last ','
-    strcat(buf, "]}"); total += 2;
-
-
-    size += vohttpd_reply_head(head, 200);
-    size += snprintf(head + size, MESSAGE_SIZE, "%s: %s\r\n", HTTP_CONTENT_TYPE, vohttpd_mime_map("json"));
-    size += snprintf(head + size, MESSAGE_SIZE, "%s: %s\r\n", HTTP_DATE_TIME, vohttpd_gmtime());
-    size += snprintf(head + size, MESSAGE_SIZE, "%s: %d\r\n", HTTP_CONTENT_LENGTH, total);
-    strcat(head + size, "\r\n"); size += 2;
-
-    size = d->set->send(d->sock, head, size, 0);
-    if(size <= 0)
-        return -1;
-    size = d->set->send(d->sock, buf, total, 0);
-    if(size <= 0)
-        return -1;
-    return 0;
+    vohttpd_response_printf(&r, "]}");
+    return vohttpd_response_send(&r) < 0 ? -1 : 0;
 }
 
 /* functions returned json format:
@@ -118,9 +95,15 @@ int plugin_list(socket_data *d, string_reference *pa)
  */
 int plugin_list_interface(socket_data *d, string_reference *pa)
 {
-    char head[MESSAGE_SIZE], buf[SENDBUF_SIZE];
     char name[FUNCTION_SIZE] = {0};
-    int size = 0, total = 0, count = 0, i;
+    const char *split = "";
+    http_response r;
+    int id = 1;
+    void *h;
+
+    _plugin_query query;
+    _plugin_func  func;
+    plugin_info   info;
 
     if(pa != NULL) {
         if(pa->size <= 0)
@@ -130,61 +113,28 @@ int plugin_list_interface(socket_data *d, string_reference *pa)
         string_reference_dup(pa, name);
     }
 
-    for(i = 0; i < d->set->funcs->max; i++) {
-        int pos = i * d->set->funcs->unit, id = 1;
-        char *key = string_hash_key(d->set->funcs, pos);
-        void *h = (void *)string_hash_val(d->set->funcs, pos);
-
-        _plugin_query query;
-        _plugin_func  func;
-        plugin_info   info;
-
-        if(strcmp(key, name))
-            continue;
-        count++;
-
-        total += snprintf(buf + total, SENDBUF_SIZE - total, "{\"status\":\"success\",");
-        query = dlsym(h, LIBRARY_QUERY);
-        if(query == NULL || query(0, &info) < 0)
-            continue;
-        total += snprintf(buf + total, SENDBUF_SIZE - total, "\"interfaces\":[");
+    // library is registered by its file name.
+    h = strchr(name, '.') ? func_table_get(d->set->funcs, name) : NULL;
+    if(h == NULL)
+        return plugin_json_status(d, "no matched plugin.");
 
+    vohttpd_response_init(&r, d, 200);
+    vohttpd_response_header(&r, HTTP_CONTENT_TYPE, vohttpd_mime_map("json"));
+    vohttpd_response_printf(&r, "{\"status\":\"success\",\"interfaces\":[");
+    query = dlsym(h, LIBRARY_QUERY);
+    if(query != NULL && query(0, &info) >= 0) {
         while(query(id++, &info) >= 0) {
             const char *status = "loaded";
             func = (_plugin_func)dlsym(h, info.name);
-            if(func != (_plugin_func)string_hash_get(d->set->funcs, info.name))
+            if(func != (_plugin_func)func_table_get(d->set->funcs, info.name))
                 status = "name conflict";
-            total += snprintf(buf + total, SENDBUF_SIZE - total, "{\"name\":\"%s\",\"note\":\"%s\","
-                "\"status\":\"%s\"},", info.name, info.note, status);
-            if(total >= SENDBUF_SIZE)
-                break;
+            vohttpd_response_printf(&r, "%s{\"name\":\"%s\",\"note\":\"%s\","
+                "\"status\":\"%s\"}", split, info.name, info.note, status);
+            split = ",";
         }
-        buf[--total] = '\0';   // remove last ','
-    }
-
-    if(total >= SENDBUF_SIZE) {
-        // FIXME: we should alloc buffer for this, SENDBUF_SIZE is limited.
-        total = snprintf(buf, SENDBUF_SIZE, "{\"status\":\"buffer is not enough!\"}");
-    } else {
-        strcat(buf, "]}");
-        total += 2;
     }
-    if(count == 0)
-        total = snprintf(buf, SENDBUF_SIZE, "{\"status\":\"no matched plugin.\"}");
-
-    size += vohttpd_reply_head(head, 200);
-    size += snprintf(head + size, MESSAGE_SIZE, "%s: %s\r\n", HTTP_CONTENT_TYPE, vohttpd_mime_map("json"));
-    size += snprintf(head + size, MESSAGE_SIZE, "%s: %s\r\n", HTTP_DATE_TIME, vohttpd_gmtime());
-    size += snprintf(head + size, MESSAGE_SIZE, "%s: %d\r\n", HTTP_CONTENT_LENGTH, total);
-    strcat(head + size, "\r\n"); size += 2;
-
-    size = d->set->send(d->sock, head, size, 0);
-    if(size <= 0)
-        return -1;
-    size = d->set->send(d->sock, buf, total, 0);
-    if(size <= 0)
-        return -1;
-    return 0;
+    vohttpd_response_printf(&r, "]}");
+    return vohttpd_response_send(&r) < 0 ? -1 : 0;
 }
 
 int plugin_load(socket_data *d, string_reference *pa)
@@ -227,12 +177,49 @@ int plugin_unload(socket_data *d, string_reference *pa)
  * }
  * status: success or error status.
  */
-int plugin_install(socket_data *d, string_reference *pa)
+typedef struct _plugin_install_state {
+    char name[FUNCTION_SIZE];
+    char path[MESSAGE_SIZE];    // installed plugin.
+    char temp[MESSAGE_SIZE];    // written by the pool thread.
+} plugin_install_state;
+
+/* on the loop after the file is written, the plugin table is loop only. */
+static int plugin_install_load(socket_data *d, uint event)
 {
-    char boundary[MESSAGE_SIZE] = {0}, path[MESSAGE_SIZE], *p, *e;
-    char name[FUNCTION_SIZE] = {0};
+    plugin_install_state *s = (plugin_install_state *)d->user;
     const char *msg;
 
+    if(event == EVENT_CLOSED || func_table_get(d->set->funcs, s->name) != NULL) {
+        remove(s->temp);
+        return event == EVENT_CLOSED ? 0 :
+            plugin_json_status(d, "unload exists plugin first.");
+    }
+    // the loaded file is never rewritten in place, rename is atomic.
+    if(rename(s->temp, s->path) != 0) {
+        remove(s->temp);
+        return plugin_json_status(d, "can not write file.");
+    }
+
+    // load plugin to vphttpd.
+    msg = d->set->load_plugin(s->path);
+    if(msg != NULL)  // error, delete uploaded file.
+        remove(s->path);
+    return plugin_json_status(d, msg == NULL ? "success" : msg);
+}
+
+/* runs on a pool thread, it writes the file and leaves loading to the loop. */
+int plugin_install(socket_data *d, string_reference *pa)
+{
+    char boundary[MESSAGE_SIZE] = {0}, *p, *e;
+    plugin_install_state *s;
+    size_t size;
+    FILE *fp;
+
+    s = (plugin_install_state *)vohttpd_alloc(d, sizeof(plugin_install_state));
+    if(s == NULL)
+        return plugin_json_status(d, "out of memory.");
+    memset(s, 0, sizeof(plugin_install_state));
+
     // get boundary.
     p = strstr(pa->ref, "\r\n");
     if(p == NULL)
@@ -251,9 +238,9 @@ int plugin_install(socket_data *d, string_reference *pa)
         return plugin_json_status(d, "can not get file name.");
     if(e - p >= FUNCTION_SIZE)
         return plugin_json_status(d, "plugin name is too long.");
-    memcpy(name, p, e - p);
-    if(string_hash_get(d->set->funcs, name) != NULL)
-        return plugin_json_status(d, "unload exists plugin first.");
+    memcpy(s->name, p, e - p);
+    if(strchr(s->name, '/') || strchr(s->name, '\\'))
+        return plugin_json_status(d, "plugin name is incorrect.");
 
     // get file data, store to local.
     p = strstr(e, "\r\n\r\n");
@@ -267,38 +254,27 @@ int plugin_install(socket_data *d, string_reference *pa)
         return plugin_json_status(d, "no end of content.");
 
     // write file to local, default: /var/www/html/cgi-bin/.
-    snprintf(path, MESSAGE_SIZE, "%s" HTTP_CGI_BIN "%s", d->set->base, name);
-
-    switch(d->type) {
-    case SOCKET_DATA_MMAP: {  // mmap memory
-        char map[MESSAGE_SIZE];
-        int size = e - p - 2;
-        snprintf(map, MESSAGE_SIZE, "%s" HTTP_CGI_BIN MMAP_FILE_NAME, d->set->base, d->sock);
-
-        memmove(d->body, p, size);
-        msync(d->body, size, MS_SYNC);
-        munmap(d->body, d->size);
-
-        // set buffer to NULL to avoid pointer issue.
-        d->body = NULL;
-        truncate(map, size);
-        rename(map, path);
-        break; }
-
-    case SOCKET_DATA_STACK: {
-        FILE *fp = fopen(path, "wb");
-        if(fp == NULL)
-            return plugin_json_status(d, "can not open file.");
-        fwrite(p, 1, e - p - 2, fp);
-        fclose(fp);
-        break; }
+    snprintf(s->path, MESSAGE_SIZE, "%s" HTTP_CGI_BIN "%s", d->set->base, s->name);
+    snprintf(s->temp, MESSAGE_SIZE, "%s.part", s->path);
+
+    // the body only lives in memory, persist the plugin explicitly.
+    fp = fopen(s->temp, "wb");
+    if(fp == NULL)
+        return plugin_json_status(d, "can not open file.");
+    size = e - p - 2;
+    if(fwrite(p, 1, size, fp) != size)
+        size = 0;
+    if(fclose(fp) != 0 || size == 0) {
+        remove(s->temp);
+        return plugin_json_status(d, "can not write file.");
     }
 
-    // load plugin to vphttpd.
-    msg = d->set->load_plugin(path);
-    if(msg != NULL)  // error, delete uploaded file.
-        remove(path);
-    return plugin_json_status(d, msg == NULL ? "success" : msg);
+    d->user = s;
+    if(vohttpd_suspend(d, -1, 0, 0, plugin_install_load) < 0) {
+        remove(s->temp);
+        return plugin_json_status(d, "can not load plugin.");
+    }
+    return 0;
 }
 
 int plugin_uninstall(socket_data *d, string_reference *pa)
@@ -320,6 +296,47 @@ int plugin_uninstall(socket_data *d, string_reference *pa)
     return plugin_json_status(d, msg == NULL ? "success" : msg);
 }
 
+/* long polling, reply once the plugin is loaded(by another request or
+ * worker), or after PLUGIN_WAIT_TIMEOUT seconds. the request is suspended
+ * between the checks, it does not hold the loop or a thread.
+ */
+#define PLUGIN_WAIT_TIMEOUT     30
+
+typedef struct _plugin_wait_state {
+    uint left;                  // seconds left.
+    char name[FUNCTION_SIZE];
+} plugin_wait_state;
+
+static int plugin_wait_check(socket_data *d, uint event)
+{
+    plugin_wait_state *s = (plugin_wait_state *)d->user;
+
+    if(event == EVENT_CLOSED)
+        return 0;   // nothing to clean up, state is in request arena.
+    if(func_table_get(d->set->funcs, s->name) != NULL)
+        return plugin_json_status(d, "success");
+    if(s->left-- == 0)
+        return plugin_json_status(d, "timeout");
+    if(vohttpd_suspend(d, -1, 0, 1, plugin_wait_check) < 0)
+        return plugin_json_status(d, "can not wait.");
+    return 0;
+}
+
+int plugin_wait(socket_data *d, string_reference *pa)
+{
+    plugin_wait_state *s;
+
+    if(pa->size == 0 || pa->size >= FUNCTION_SIZE)
+        return plugin_json_status(d, "plugin name is not correct.");
+    s = (plugin_wait_state *)vohttpd_alloc(d, sizeof(plugin_wait_state));
+    if(s == NULL)
+        return plugin_json_status(d, "out of memory.");
+    string_reference_dup(pa, s->name);
+    s->left = PLUGIN_WAIT_TIMEOUT;
+    d->user = s;
+    return plugin_wait_check(d, 0);
+}
+
 int vohttpd_library_query(int id, plugin_info *out)
 {
     static plugin_info info[] = {
@@ -328,8 +345,9 @@ int vohttpd_library_query(int id, plugin_info *out)
     { "plugin_list_interface", "list all functions by the plugin name." },
     { "plugin_load", "load plugin by its name, search cgi-bin first, then vohttpd default plugin folder." },
     { "plugin_unload", "unload plugin by its name, search cgi-bin first, then vohttpd default plugin folder." },
-    { "plugin_install", "install plugin to vohttpd temp/default plugin folder." },
+    { "plugin_install", "install plugin to vohttpd temp/default plugin folder.", PLUGIN_BLOCKING },
     { "plugin_uninstall", "remove plugin it from vohttpd temp/default folder." },
+    { "plugin_wait", "plugin_wait?name, reply when the plugin is loaded, or timeout in 30 seconds." },
     };
     if(id >= sizeof(info) / sizeof(plugin_info))
         return -1;
@@ -6,38 +6,192 @@
  *
  */
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
 
 #include "../vohttpd.h"
 
 int test_text(socket_data *d, string_reference *pa)
 {
-    char head[MESSAGE_SIZE], buf[MESSAGE_SIZE];
-    int size, total;
+    static const char text[] = "<html><head><title>test_text</title></head>"
+        "<body><h1>Hello World!</h1></body></html>";
+    http_response r;
 
-    total = sprintf(buf, "<html><head><title>test_text</title></head><body><h"
-        "1>Hello World!</h1></body></html>");
+    vohttpd_unused(pa);
+    vohttpd_response_init(&r, d, 200);
+    vohttpd_response_header(&r, HTTP_CONTENT_TYPE, vohttpd_mime_map("html"));
+    vohttpd_response_ref(&r, text, sizeof(text) - 1);
+    return vohttpd_response_send(&r) < 0 ? -1 : 0;
+}
+
+/* blocking test, sleeps for the given milliseconds(max 10000) on a pool
+ * thread, other requests are served meanwhile.
+ */
+int test_sleep(socket_data *d, string_reference *pa)
+{
+    char buf[16] = {0};
+    http_response r;
+    int ms;
+
+    memcpy(buf, pa->ref, min(pa->size, sizeof(buf) - 1));
+    ms = max(0, min(atoi(buf), 10000));
+    usleep(ms * 1000);
+
+    vohttpd_response_init(&r, d, 200);
+    vohttpd_response_header(&r, HTTP_CONTENT_TYPE, vohttpd_mime_map("json"));
+    vohttpd_response_printf(&r, "{\"slept\":%d}", ms);
+    return vohttpd_response_send(&r) < 0 ? -1 : 0;
+}
+
+/* async test, asks the local http server on the given port for its root
+ * page and shows the status line. the request is suspended while it
+ * connects and waits, nothing blocks.
+ */
+typedef struct _test_fetch_state {
+    int fd;
+} test_fetch_state;
 
-    size = vohttpd_reply_head(head, 200);
-    size += sprintf(head + size, "%s: %s\r\n", HTTP_CONTENT_TYPE, vohttpd_mime_map("html"));
-    size += sprintf(head + size, "%s: %s\r\n", HTTP_DATE_TIME, vohttpd_gmtime());
-    size += sprintf(head + size, "%s: %d\r\n", HTTP_CONTENT_LENGTH, total);
-    strcat(head + size, "\r\n"); size += 2;
+static int test_fetch_reply(socket_data *d, int code, const char *line, int size)
+{
+    test_fetch_state *s = (test_fetch_state *)d->user;
+    http_response r;
+
+    close(s->fd);
+    vohttpd_response_init(&r, d, code);
+    vohttpd_response_header(&r, HTTP_CONTENT_TYPE, vohttpd_mime_map("txt"));
+    vohttpd_response_write(&r, line, size);
+    return vohttpd_response_send(&r) < 0 ? -1 : 0;
+}
 
-    size = d->set->send(d->sock, head, size, 0);
+static int test_fetch_read(socket_data *d, uint event)
+{
+    test_fetch_state *s = (test_fetch_state *)d->user;
+    char buf[MESSAGE_SIZE], *e;
+    int size;
+
+    if(event == EVENT_CLOSED) {
+        close(s->fd);
+        return 0;
+    }
+    if(event == 0)
+        return test_fetch_reply(d, 504, "backend timeout", 15);
+
+    size = recv(s->fd, buf, sizeof(buf), 0);
     if(size <= 0)
+        return test_fetch_reply(d, 502, "backend closed", 14);
+    e = memchr(buf, '\r', size);
+    return test_fetch_reply(d, 200, buf, e ? e - buf : size);
+}
+
+static int test_fetch_send(socket_data *d, uint event)
+{
+    static const char req[] = "GET / HTTP/1.0\r\n\r\n";
+    test_fetch_state *s = (test_fetch_state *)d->user;
+    socklen_t len = sizeof(int);
+    int err = 0;
+
+    if(event == EVENT_CLOSED) {
+        close(s->fd);
+        return 0;
+    }
+    if(event == 0)
+        return test_fetch_reply(d, 504, "connect timeout", 15);
+
+    getsockopt(s->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+    if(err != 0 || send(s->fd, req, sizeof(req) - 1, MSG_NOSIGNAL) != sizeof(req) - 1)
+        return test_fetch_reply(d, 502, "can not connect", 15);
+    if(vohttpd_suspend(d, s->fd, EVENT_READ, 5, test_fetch_read) < 0)
+        return test_fetch_reply(d, 500, "can not suspend", 15);
+    return 0;
+}
+
+int test_fetch(socket_data *d, string_reference *pa)
+{
+    struct sockaddr_in addr;
+    test_fetch_state *s;
+    char port[8] = {0};
+
+    s = (test_fetch_state *)vohttpd_alloc(d, sizeof(test_fetch_state));
+    if(s == NULL)
         return -1;
-    size = d->set->send(d->sock, buf, total, 0);
-    if(size <= 0)
+    d->user = s;
+
+    memcpy(port, pa->ref, min(pa->size, sizeof(port) - 1));
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(atoi(port) ? atoi(port) : d->set->port);
+
+    s->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if(s->fd < 0)
+        return test_fetch_reply(d, 500, "no socket", 9);
+    if(connect(s->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 && errno != EINPROGRESS)
+        return test_fetch_reply(d, 502, "can not connect", 15);
+    if(vohttpd_suspend(d, s->fd, EVENT_WRITE, 5, test_fetch_send) < 0)
+        return test_fetch_reply(d, 500, "can not suspend", 15);
+    return 0;
+}
+
+/* upload test, POST any size of data, it returns the size and fnv-1a hash
+ * of the data, memory used does not grow with the data size.
+ */
+typedef struct _test_upload_state {
+    unsigned long long size;
+    uint hash;
+} test_upload_state;
+
+static int test_upload_begin(socket_data *d, string_reference *pa)
+{
+    test_upload_state *s;
+
+    vohttpd_unused(pa);
+    s = (test_upload_state *)vohttpd_alloc(d, sizeof(test_upload_state));
+    if(s == NULL)
         return -1;
+    s->size = 0;
+    s->hash = 2166136261u;
+    d->user = s;
+    return 0;
+}
+
+static int test_upload_data(socket_data *d, const char *data, uint size)
+{
+    test_upload_state *s = (test_upload_state *)d->user;
+    uint i;
+
+    for(i = 0; i < size; i++)
+        s->hash = (s->hash ^ (uchar)data[i]) * 16777619u;
+    s->size += size;
     return 0;
 }
 
+static int test_upload_end(socket_data *d)
+{
+    test_upload_state *s = (test_upload_state *)d->user;
+    http_response r;
+
+    vohttpd_response_init(&r, d, 200);
+    vohttpd_response_header(&r, HTTP_CONTENT_TYPE, vohttpd_mime_map("json"));
+    vohttpd_response_printf(&r, "{\"size\":%llu,\"fnv1a\":\"%08x\"}", s->size, s->hash);
+    return vohttpd_response_send(&r) < 0 ? -1 : 0;
+}
+
+const plugin_stream test_upload = {
+    test_upload_begin, test_upload_data, test_upload_end, NULL
+};
+
 int vohttpd_library_query(int id, plugin_info *out)
 {
     static plugin_info info[] = {
     { ".", "contains test functions for vohttpd." },
     { "test_text", "it will always show hello world." },
+    { "test_upload", "POST data, it shows data size and hash.", PLUGIN_STREAM },
+    { "test_sleep", "test_sleep?ms, it replies after ms on a pool thread.", PLUGIN_BLOCKING },
+    { "test_fetch", "test_fetch?port, async request to local http server, shows its status.", 0 },
     };
     if(id >= sizeof(info) / sizeof(plugin_info))
         return -1;
@@ -9,7 +9,11 @@
  *   maybe use polarSSL.
  */
 
+#define _GNU_SOURCE     // sched_setaffinity, mremap
+
 #include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <memory.h>
 #include <stdio.h>
 #include <arpa/inet.h>
@@ -19,6 +23,11 @@
 #include <sys/signal.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/ioctl.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
 #include <netinet/in.h>
 #include <netdb.h>
 #include <errno.h>
@@ -27,18 +36,93 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <dirent.h>
+#include <sched.h>
+#include <sys/wait.h>
+#include <time.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #include "vohttpd.h"
 
-#define HTTP_HEADER_END     "\r\n\r\n"
-#define HTTP_GET            "GET"
-#define HTTP_POST           "POST"
 #define HTTP_FONT           "Helvetica,Arial,sans-serif"
 
-#define TIMEOUT             3000
+#define HEAD_TIMEOUT        3       // seconds to receive the full request head.
+#define BODY_TIMEOUT        10      // seconds without any request body data.
+#define SEND_TIMEOUT        10      // seconds, window of the slow client read rate check.
+#define SEND_RATE           1024    // bytes/s
+#define STREAM_CHUNK_SIZE   (RECVBUF_SIZE * 4)  // max body chunk of one stream recv.
+#define SENDQ_CHUNK_SIZE    (16 * 1024)         // small queued sends share one chunk.
+#define SENDQ_LIMIT         (32 * 1024 * 1024)  // max queued memory of one connection.
+#define KEEPALIVE_TIMEOUT   5       // seconds
+#define KEEPALIVE_REQUESTS  100
+#define BODY_LIMIT          (128 * 1024 * 1024) // max buffered body of one request.
+#define SPILL_LIMIT         (512 * 1024 * 1024) // max buffered bodies of one process.
+#define SPILL_STEP          (1024 * 1024)       // body memory grows by doubling from it.
+#define HTTP_DATE_SIZE      29      // "Sun, 06 Nov 1994 08:49:37 GMT"
+#define POOL_THREADS        4       // threads for blocking plugin functions.
+#define POOL_QUEUE_SIZE     1024    // max jobs waiting for a thread.
+#define POOL_THREAD_MAX     256
 
 static vohttpd g_set;
 
+/* worker mode, every worker has its own listen socket(SO_REUSEPORT), socket
+ * table and event loop. plugin load/unload is broadcast through the pipes,
+ * g_pipes[workers] belongs to master so respawned workers get the changes.
+ */
+enum WORKER_MESSAGE_TYPE {
+    WORKER_LOAD_PLUGIN,
+    WORKER_UNLOAD_PLUGIN,
+};
+
+typedef struct _worker_message {
+    int   type;
+    char  path[MESSAGE_SIZE];
+} worker_message;
+
+static int g_pipes[WORKER_COUNT + 1][2];
+
+/* receive buffers by size class, idle connections do not hold any. */
+typedef struct _buffer_pool {
+    uint    count;
+    void*   free[RECVBUF_FREE_COUNT];
+} buffer_pool;
+
+static buffer_pool g_pool[RECVBUF_CLASS];
+static buffer_pool g_reqs;      // parsed request objects.
+static buffer_pool g_chunks;    // request arena chunks of ARENA_CHUNK_SIZE.
+static volatile sig_atomic_t g_stop;
+
+/* blocking plugin function call, lives in the request arena. */
+typedef struct _plugin_job {
+    thread_job       job;
+    socket_data*     d;
+    _plugin_func     func;
+    string_reference pa;
+    struct _plugin_job* prev;   // running list, loop only.
+    struct _plugin_job* next;
+} plugin_job;
+
+/* library unloaded while its blocking functions still run on the pool,
+ * it is closed once the last of them returns.
+ */
+typedef struct _plugin_closing {
+    void*   handle;
+    void*   base;       // load address, to find its functions.
+    uint    jobs;       // its functions still running.
+    struct _plugin_closing* next;
+} plugin_closing;
+
+static plugin_job*     g_running;   // submitted jobs not returned yet.
+static plugin_closing* g_closing;
+
+// connection of the blocking function running on this thread, the pools
+// above belong to the loop.
+static __thread socket_data* g_job;
+
 /* input, file path: /var/www/html/index.html
  * output, file name: index.html
  * return, the length of the file name.
@@ -59,313 +143,1386 @@ int get_name_from_path(const char *path, char *name, size_t size)
     return strlen(name);
 }
 
-/* alloc a new buffer for http request.
- * we use its socket as http request key to make it simple.
- * socket data contains full information of a request.
- */
-socket_data* socketdata_new(linear_hash *socks, int sock)
+/* get a receive buffer no smaller than size, NULL if size is too large. */
+char* buffer_pool_get(uint size, uint *limit)
 {
-    socket_data *d;
-
-    d = (socket_data *)linear_hash_set(socks, (uint)sock);
-    if(d == NULL)
-        return NULL;      // buffer has full...show error page?
+    uint i, n = RECVBUF_SIZE;
+    char *p;
 
-    memset(d, 0, sizeof(socket_data));
-    d->sock = sock;
-    d->set = &g_set;
-    return d;
+    for(i = 0; i < RECVBUF_CLASS; i++, n *= 4) {
+        if(size > n)
+            continue;
+        if(g_pool[i].count)
+            p = (char *)g_pool[i].free[--g_pool[i].count];
+        else
+            p = (char *)malloc(n);
+        if(p == NULL)
+            return NULL;
+        *limit = n;
+        return p;
+    }
+    return NULL;
 }
 
-void socketdata_delete(linear_hash *socks, int sock)
+void buffer_pool_put(char *p, uint limit)
 {
-    socket_data *d;
+    uint i, n = RECVBUF_SIZE;
 
-    d = (socket_data *)linear_hash_get(socks, sock);
-    if(d == NULL)
-        return;
-
-    close(sock);
-    // delete the map file in tmp folder(created when post data > BUFFER_SIZE)
-    if(d->type == SOCKET_DATA_MMAP && d->body) {
-        char map[MESSAGE_SIZE];
-        munmap(d->body, d->size);
-        snprintf(map, MESSAGE_SIZE, "%s" HTTP_CGI_BIN MMAP_FILE_NAME, d->set->base, d->sock);
-        remove(map);       // the map file might not exists.
+    for(i = 0; i < RECVBUF_CLASS; i++, n *= 4) {
+        if(limit == n && g_pool[i].count < RECVBUF_FREE_COUNT) {
+            g_pool[i].free[g_pool[i].count++] = p;
+            return;
+        }
     }
+    free(p);
+}
 
-    linear_hash_remove(socks, sock);
+void buffer_pool_clear()
+{
+    uint i;
+    for(i = 0; i < RECVBUF_CLASS; i++) {
+        while(g_pool[i].count)
+            free(g_pool[i].free[--g_pool[i].count]);
+    }
+    while(g_reqs.count)
+        free(g_reqs.free[--g_reqs.count]);
+    while(g_chunks.count)
+        free(g_chunks.free[--g_chunks.count]);
 }
 
-uint vohttpd_decode_content_size(socket_data *d)
+/* request arena, bump allocation from pooled chunks.
+ * larger memory gets its own chunk which is not pooled.
+ */
+void* vohttpd_arena_alloc(socket_data *d, uint size)
 {
-    char *p;
+    arena_chunk *c = d->arena;
+    uint need;
+    void *p;
+
+    size = (size + 15) & ~15u;
+    if(c == NULL || c->used + size > c->size) {
+        need = max(size, ARENA_CHUNK_SIZE);
+        if(need == ARENA_CHUNK_SIZE && g_chunks.count && g_job == NULL)
+            c = (arena_chunk *)g_chunks.free[--g_chunks.count];
+        else
+            c = (arena_chunk *)malloc(offsetof(arena_chunk, data) + need);
+        if(c == NULL)
+            return NULL;
+        c->size = need;
+        c->used = 0;
+        c->next = d->arena;
+        d->arena = c;
+    }
+    p = c->data + c->used;
+    c->used += size;
+    return p;
+}
 
-    p = strstr(d->head, HTTP_CONTENT_LENGTH);
-    if(p == NULL)
-        return 0;
-    p += sizeof(HTTP_CONTENT_LENGTH) - 1;
+void vohttpd_arena_reset(socket_data *d)
+{
+    arena_chunk *c;
 
-    while((*p < '0' || *p > '9') && *p != '\r' && *p != '\n')
-        p++;
+    while(d->arena) {
+        c = d->arena;
+        d->arena = c->next;
+        if(c->size == ARENA_CHUNK_SIZE && g_chunks.count < ARENA_FREE_COUNT)
+            g_chunks.free[g_chunks.count++] = c;
+        else
+            free(c);
+    }
+}
 
-    return (uint)atoi(p);
+/* parse the complete head of current request into d->req.
+ * return 0 if success, or the http error code.
+ */
+int socketdata_parse(socket_data *d, uint size)
+{
+    if(d->req == NULL) {
+        if(g_reqs.count)
+            d->req = (http_request *)g_reqs.free[--g_reqs.count];
+        else
+            d->req = (http_request *)malloc(sizeof(http_request));
+        if(d->req == NULL)
+            return 413;
+    }
+    return vohttpd_parse_request(d->req, d->head, size);
 }
 
-uint vohttpd_file_size(const char *path)
+void socketdata_unparse(socket_data *d)
 {
-    FILE *fp;
-    uint size;
+    if(d->req == NULL)
+        return;
+    if(g_reqs.count < RECVBUF_FREE_COUNT)
+        g_reqs.free[g_reqs.count++] = d->req;
+    else
+        free(d->req);
+    d->req = NULL;
+}
 
-    fp = fopen(path, "rb");
-    if(fp == NULL)
-        return (uint)(-1);
-    fseek(fp, 0, SEEK_END);
-    size = (uint)ftell(fp);
+/* make sure the head buffer can hold size bytes(and the ending zero). */
+int socketdata_buffer(socket_data *d, uint size)
+{
+    uint limit;
+    char *p;
 
-    fclose(fp);
-    return size;
+    if(size < d->limit)
+        return 0;
+    p = buffer_pool_get(size + 1, &limit);
+    if(p == NULL)
+        return -1;
+    if(d->head) {
+        memcpy(p, d->head, d->used);
+        buffer_pool_put(d->head, d->limit);
+    }
+    p[d->used] = '\0';
+    d->head = p;
+    d->limit = limit;
+    return 0;
 }
 
-const char *vohttpd_file_extend(const char *path)
+/* give the head buffer back when nothing is pending in it. */
+void socketdata_release(socket_data *d)
 {
-    const char *p = strrchr(path, '.');
-    return p == NULL ? p : (p + 1);
+    if(d->head == NULL || d->used)
+        return;
+    buffer_pool_put(d->head, d->limit);
+    d->head = NULL;
+    d->limit = 0;
 }
 
-int vohttpd_is_folder(const char *path)
+socket_table* socket_table_alloc(uint max)
 {
-    struct stat s;
-    if(lstat(path, &s) < 0)
-        return 0;
-    return S_ISDIR(s.st_mode);
+    socket_table *st = (socket_table *)malloc(sizeof(socket_table));
+    if(st == NULL)
+        return NULL;
+
+    memset(st, 0, sizeof(socket_table));
+    st->node = (socket_data **)calloc(max, sizeof(socket_data *));
+    if(st->node == NULL) {
+        free(st);
+        return NULL;
+    }
+    st->max = max;
+    return st;
 }
 
-int vohttpd_http_file(socket_data *d, const char *param)
+/* release connections closed in this loop round. */
+void socket_table_flush(socket_table *st)
 {
-    char buf[SENDBUF_SIZE], *p;
-    char path[MESSAGE_SIZE];
-    const char* ext;
-    int size, total = 0;
-    FILE *fp;
-
-    // file name might contains parameter, we should cut it.
-    if(p = strchr(param, '?'), p != NULL)
-        strncpy(path, param, p - param);
-    else
-        strncpy(path, param, MESSAGE_SIZE);
+    socket_data *d;
 
-    total = vohttpd_file_size(path);
-    if(total == -1)
-        return d->set->error_page(d, 404, NULL);
+    // keep a few for the next connections, release the rest.
+    while(st->closed) {
+        d = st->closed;
+        st->closed = d->next;
+        if(st->spare < SOCKET_FREE_COUNT) {
+            d->next = st->free;
+            st->free = d;
+            st->spare++;
+        } else {
+            free(d);
+        }
+    }
+}
 
-    ext = vohttpd_file_extend(path);
-    size = vohttpd_reply_head(buf, 200);
-    size += snprintf(buf + size, SENDBUF_SIZE - size, "%s: %d\r\n", HTTP_CONTENT_LENGTH, total);
-    size += snprintf(buf + size, SENDBUF_SIZE - size, "%s: %s\r\n", HTTP_DATE_TIME, vohttpd_gmtime());
-    size += snprintf(buf + size, SENDBUF_SIZE - size, "%s: %s\r\n", HTTP_CONTENT_TYPE, vohttpd_mime_map(ext));
-    size += snprintf(buf + size, SENDBUF_SIZE - size, "%s: %s\r\n", HTTP_CONNECTION, "close");
-    strcat(buf + size, "\r\n"); size += 2;
+#define socket_table_get(st, s) ((uint)(s) < (st)->max ? (st)->node[(s)] : NULL)
 
-    size = d->set->send(d->sock, buf, size, 0);
-    if(size <= 0)
-        return -1;
+/* set what the connection waits for and its deadline. */
+void socketdata_wait(socket_data *d, uint wait, uint secs)
+{
+    d->wait = wait;
+    timer_add(g_set.timers, &d->timer, g_set.now + secs);
+}
 
-    fp = fopen(path, "rb");
-    if(fp == NULL)
-        return d->set->error_page(d, 405, NULL);
+/* bytes the client has read of what out gave to the kernel, it may be
+ * negative, what was sent before queueing is not counted in sent.
+ */
+static long long socketdata_taken(socket_data *d)
+{
+    int n = 0;
+#ifdef TIOCOUTQ
+    // unsent bytes in the socket buffer, the same as SIOCOUTQ.
+    if(ioctl(d->sock, TIOCOUTQ, &n) < 0)
+        n = 0;
+#endif
+    return d->sent - n;
+}
 
-    while(!feof(fp)) {
-        size = fread(buf, 1, SENDBUF_SIZE, fp);
-        if(size <= 0)
-            break;
-        size = d->set->send(d->sock, buf, size, 0);
-        if(size <= 0)
-            break;
-        total += size;
-    }
-    fclose(fp);
-    return total;
+/* response is queued, check how much the client reads when it expires. */
+static void socketdata_wait_send(socket_data *d)
+{
+    d->taken = socketdata_taken(d);
+    socketdata_wait(d, SOCKET_WAIT_SEND, SEND_TIMEOUT);
 }
 
-int vohttpd_http_folder(socket_data *d, const char *path)
+/* send file range to the socket, offset moves by the sent size. */
+static ssize_t socket_send_file(int sock, int fd, long long *offset, long long size)
 {
+    ssize_t ret;
+#ifdef __linux__
+    off_t off = (off_t)*offset;
+    ret = sendfile(sock, fd, &off, (size_t)min(size, 0x7ffff000));
+#else
     char buf[SENDBUF_SIZE];
-    int size, total = 0;
-    DIR *dir;
-    struct dirent *dp;
+    ret = pread(fd, buf, (size_t)min(size, SENDBUF_SIZE), (off_t)*offset);
+    if(ret > 0)
+        ret = send(sock, buf, ret, MSG_DONTWAIT | MSG_NOSIGNAL);
+#endif
+    if(ret > 0)
+        *offset += ret;
+    return ret;
+}
 
-    dir = opendir(path);
-    if(dir == NULL)
-        return d->set->error_page(d, 404, "can not open the folder.");
+static void socketdata_queue_link(socket_data *d, send_chunk *c)
+{
+    c->next = NULL;
+    if(d->last) {
+        d->last->next = c;
+        d->last = c;
+        return;
+    }
 
-    size = vohttpd_reply_head(buf, 200);
-    size += snprintf(buf + size, SENDBUF_SIZE - size, "%s: %s\r\n", HTTP_DATE_TIME, vohttpd_gmtime());
-    size += snprintf(buf + size, SENDBUF_SIZE - size, "%s: %s\r\n", HTTP_CONTENT_TYPE, vohttpd_mime_map("html"));
-    size += snprintf(buf + size, SENDBUF_SIZE - size, "%s: %s\r\n", HTTP_CONNECTION, "close");
-    strcat(buf + size, "\r\n"); size += 2;
-    size = d->set->send(d->sock, buf, size, 0);
+    // first queued data, wait for the socket to be writable. a pool thread
+    // leaves it to the loop. a backend which sends by itself takes the queue.
+    d->out = d->last = c;
+    if(d->busy)
+        return;
+    if(g_set.event->send == NULL)
+        g_set.event->mod(g_set.poll, d->sock, EVENT_WRITE, d);
+    else if(g_set.event->send(g_set.poll, d->sock, d, c) == 0)
+        d->sending = 1;
+    if(d->async == NULL)    // suspended request keeps its own deadline.
+        socketdata_wait_send(d);
+}
 
-    size = snprintf(buf, SENDBUF_SIZE, "<html><head><title>%s</title></head>"
-        "<body style=\"font-family:" HTTP_FONT "\"><h2>%s</h2><hr>", path, path);
-    total += d->set->send(d->sock, buf, size, 0);
+/* copy data to the output queue, return < 0 if the queue is full. */
+static int socketdata_queue_data(socket_data *d, const char *data, uint size)
+{
+    send_chunk *c = d->last;
+    uint n;
 
-    while(dp = readdir(dir), dp) {
-        if(strcmp(dp->d_name, ".") == 0 || strcmp(dp->d_name, "..") == 0)
-            continue;
-        if(dp->d_type == DT_DIR)
-            size = snprintf(buf, SENDBUF_SIZE, "<p id=\"dir\"><b>[%s]</b><p>", dp->d_name);
-        else
-            size = snprintf(buf, SENDBUF_SIZE, "<p id=\"file\">%s</p>", dp->d_name);
-        total += d->set->send(d->sock, buf, size, 0);
+    if(d->queued + size > SENDQ_LIMIT)
+        return -1;
+
+    // fill the room of last chunk first.
+    if(c && c->fd < 0 && c->used < c->size) {
+        n = min(size, c->size - c->used);
+        memcpy(c->data + c->used, data, n);
+        c->used += n;
+        d->queued += n;
+        data += n;
+        size -= n;
     }
-    closedir(dir);
+    if(size == 0)
+        return 0;
 
-    size = snprintf(buf, SENDBUF_SIZE, "</body></html>");
-    total += d->set->send(d->sock, buf, size, 0);
-    return total;
+    n = max(size, SENDQ_CHUNK_SIZE);
+    c = (send_chunk *)malloc(sizeof(send_chunk) + n);
+    if(c == NULL)
+        return -1;
+    c->fd = -1;
+    c->size = n;
+    c->used = size;
+    c->offset = 0;
+    c->left = 0;
+    memcpy(c->data, data, size);
+    d->queued += size;
+    socketdata_queue_link(d, c);
+    return 0;
 }
 
-int vohttpd_default(socket_data *d, string_reference *fn)
+/* queue file range, the cached file might be closed before it is sent,
+ * so the chunk has its own descriptor.
+ */
+static int socketdata_queue_file(socket_data *d, int fd, long long offset, long long size)
 {
-    char head[MESSAGE_SIZE];
-    char path[MESSAGE_SIZE];
-
-    if(fn->size >= MESSAGE_SIZE)
-        return d->set->error_page(d, 413, NULL);
-    string_reference_dup(fn, head);
-    if(strstr(head, ".."))
-        return d->set->error_page(d, 403, NULL);
+    send_chunk *c;
 
-    if(head[fn->size - 1] == '/') {
-        snprintf(path, MESSAGE_SIZE, "%s/%sindex.html", g_set.base, head);
-        if(vohttpd_file_size(path) != (uint)(-1))
-            return d->set->http_file(d, path);
-        // no index.html, we show it as folder.
+    c = (send_chunk *)malloc(sizeof(send_chunk));
+    if(c == NULL)
+        return -1;
+    c->fd = dup(fd);
+    if(c->fd < 0) {
+        free(c);
+        return -1;
     }
+    c->size = c->used = 0;
+    c->offset = offset;
+    c->left = size;
+    socketdata_queue_link(d, c);
+    return 0;
+}
 
-    // the address might be a file.
-    snprintf(path, MESSAGE_SIZE, "%s%s", g_set.base, head);
-    if(vohttpd_is_folder(path))
-        return d->set->http_folder(d, path);
-    else
-        return d->set->http_file(d, path);
+static void socketdata_queue_free(socket_data *d)
+{
+    send_chunk *c;
+
+    // memory the backend is sending is freed by the backend.
+    if(d->sending && d->out && d->out->fd < 0)
+        d->out = d->out->next;
+    d->sending = 0;
+    while((c = d->out) != NULL) {
+        d->out = c->next;
+        if(c->fd >= 0)
+            close(c->fd);
+        free(c);
+    }
+    d->last = NULL;
+    d->queued = 0;
 }
 
-int vohttpd_function(socket_data *d, string_reference *fn, string_reference *pa)
+/* send queued response until the socket is full.
+ * return 0 if all sent, 1 if some is left, < 0 if the socket is broken.
+ */
+static int socketdata_flush(socket_data *d)
 {
-    char name[FUNCTION_SIZE];
-    _plugin_func func;
+    long long sent = d->sent;
+    send_chunk *c;
+    ssize_t ret;
+
+    if(g_set.event->send) {
+        if(d->out && !d->sending) {
+            if(g_set.event->send(g_set.poll, d->sock, d, d->out) < 0)
+                return -1;
+            d->sending = 1;
+        }
+        return d->out != NULL;
+    }
 
-    if(fn->size >= FUNCTION_SIZE)
-        return d->set->error_page(d, 413, NULL);
-    string_reference_dup(fn, name);
-    if(strchr(name, '.') != NULL)   // this is library handle.
-        return d->set->error_page(d, 403, NULL);
-    func = (_plugin_func)string_hash_get(d->set->funcs, name);
-    if(func == NULL)
-        return d->set->error_page(d, 404, NULL);
+    while((c = d->out) != NULL) {
+        if(c->fd < 0)
+            ret = send(d->sock, c->data + c->offset, c->used - (uint)c->offset,
+                    MSG_DONTWAIT | MSG_NOSIGNAL);
+        else
+            ret = socket_send_file(d->sock, c->fd, &c->offset, c->left);
+        if(ret < 0 && errno == EINTR)
+            continue;
+        if(ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            // the client reads, give it more time.
+            if(d->sent != sent && d->async == NULL)
+                socketdata_wait_send(d);
+            return 1;
+        }
+        if(ret <= 0)
+            return -1;
+
+        d->sent += ret;
+        if(c->fd < 0) {
+            c->offset += ret;
+            if(c->offset < c->used)
+                continue;
+            d->queued -= c->used;
+        } else {
+            c->left -= ret;
+            if(c->left > 0)
+                continue;
+            close(c->fd);
+        }
 
-    return func(d, pa);
+        d->out = c->next;
+        if(d->out == NULL)
+            d->last = NULL;
+        free(c);
+    }
+    return 0;
 }
 
-// return:
-//  0: get header do not have special request.
-//  1: get header contains function.
-//  2: get header contains function and parameters.
-//  < 0: not a valid header.
-int vohttpd_decode_get(socket_data *d, string_reference *fn, string_reference *pa)
+/* the backend has sent out from its head, drop what is done.
+ * return < 0 if the socket is broken.
+ */
+static int socketdata_sent(socket_data *d, int size)
 {
-    char *p, *e, *f1, *f2;
-    int ret;
+    send_chunk *c;
+    uint n;
 
-    p = d->head + sizeof(HTTP_GET);
-    e = strstr(p, "\r\n");
-    if(e == NULL)
+    d->sending = 0;
+    if(size < 0)
         return -1;
+    d->sent += size;
+    if(size > 0 && d->async == NULL)
+        socketdata_wait_send(d);    // the client reads, give it more time.
+    while(size > 0 && (c = d->out) != NULL) {
+        if(c->fd < 0) {
+            n = min((uint)size, c->used - (uint)c->offset);
+            c->offset += n;
+            size -= n;
+            if(c->offset < c->used)
+                break;
+            d->queued -= c->used;
+        } else {
+            n = (uint)min((long long)size, c->left);
+            c->offset += n;
+            c->left -= n;
+            size -= n;
+            if(c->left > 0)
+                break;
+            close(c->fd);
+        }
+        d->out = c->next;
+        if(d->out == NULL)
+            d->last = NULL;
+        free(c);
+    }
+    return 0;
+}
 
-    while(*p == ' ' && e != p)
-        p++;
-    if(e == p)
-        return -1;
-    while(*e != ' ' && e != p)
-        e--;
-    if(e == p)
-        return -1;
+void socket_table_free(socket_table *st)
+{
+    socket_data *d;
+    uint i;
+
+    if(st == NULL)
+        return;
+    for(i = 0; i < st->max; i++) {
+        d = st->node[i];
+        if(d == NULL)
+            continue;
+        if(d->head)
+            buffer_pool_put(d->head, d->limit);
+        free(d->req);
+        vohttpd_arena_reset(d);
+        socketdata_queue_free(d);
+        free(d);
+    }
+    socket_table_flush(st);
+    while(st->free) {
+        d = st->free;
+        st->free = d->next;
+        free(d);
+    }
+    free(st->node);
+    free(st);
+}
 
-    *e = '\0';
+/* alloc a new buffer for http request.
+ * we use its socket as http request key to make it simple.
+ * socket data contains full information of a request.
+ */
+socket_data* socketdata_new(socket_table *socks, int sock)
+{
+    socket_data *d, **node;
+    uint max;
+
+    if(sock < 0)
+        return NULL;
+
+    // the table only grows, new fds are usually reused small ones.
+    if((uint)sock >= socks->max) {
+        for(max = socks->max * 2; max <= (uint)sock; max *= 2);
+        node = (socket_data **)realloc(socks->node, max * sizeof(socket_data *));
+        if(node == NULL)
+            return NULL;
+        memset(node + socks->max, 0, (max - socks->max) * sizeof(socket_data *));
+        socks->node = node;
+        socks->max = max;
+    }
 
-    f1 = strstr(p, HTTP_CGI_BIN);
-    if(f1 == NULL) {
-        ret = 0;
-        fn->ref = p;
-        fn->size = e - p;
+    if(socks->free) {
+        d = socks->free;
+        socks->free = d->next;
+        socks->spare--;
     } else {
-        f1 += sizeof(HTTP_CGI_BIN) - 1;
-        f2 = strchr(f1, '?');
-        if(f2 == NULL) {
-            fn->ref = f1;
-            fn->size = e - f1;
-            ret = 1;
-        } else {
-            fn->ref = f1;
-            fn->size = f2 - f1;
-            ret = 2;
-            pa->ref = ++f2;
-            pa->size = e - f2;
-        }
+        d = (socket_data *)malloc(sizeof(socket_data));
+        if(d == NULL)
+            return NULL;
     }
 
-    *e = ' ';
-    return ret;
+    memset(d, 0, sizeof(socket_data));
+    d->sock = sock;
+    d->async_fd = -1;
+    d->set = &g_set;
+    socks->node[sock] = d;
+    socks->count++;
+    socketdata_wait(d, SOCKET_WAIT_HEAD, HEAD_TIMEOUT);
+    return d;
 }
 
-int vohttpd_decode_post(socket_data *d, string_reference *fn, string_reference *pa)
+/* body too big for the head buffer goes to anonymous memory, mapped in
+ * growing steps so a slow upload only holds what has arrived. one more
+ * byte than the body keeps it NUL terminated like the head buffer.
+ * return 0 or the http error code.
+ */
+static int socketdata_spill(socket_data *d, uint need)
 {
-    char *p, *e, *f1;
-    int ret;
+    uint size, top = d->size + 1;
+    void *p;
+
+    for(size = d->spill ? d->spill : SPILL_STEP; size < need;
+        size = size > top / 2 ? top : size * 2);
+    size = min(size, top);
+    if(g_set.spilled + size - d->spill > g_set.spill_limit)
+        return 503;
+
+#ifdef __linux__
+    if(d->spill)    // pages move, data is not copied.
+        p = mremap(d->body, d->spill, size, MREMAP_MAYMOVE);
+    else
+#endif
+    p = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if(p == MAP_FAILED)
+        return 503;
+
+#ifndef __linux__
+    if(d->spill) {
+        memcpy(p, d->body, d->recv);
+        munmap(d->body, d->spill);
+    }
+#endif
+    g_set.spilled += size - d->spill;
+    d->body = (char *)p;
+    d->spill = size;
+    return 0;
+}
 
-    p = d->head + sizeof(HTTP_POST);
-    e = strstr(p, "\r\n");
-    if(e == NULL)
-        return -1;
+static void socketdata_free_body(socket_data *d)
+{
+    if(d->type == SOCKET_DATA_MMAP && d->spill) {
+        munmap(d->body, d->spill);
+        g_set.spilled -= d->spill;
+        d->spill = 0;
+    }
+}
 
-    while(*p == ' ' && e != p)
-        p++;
-    if(e == p)
+/* end the async wait, return the function to call. */
+static _async_func socketdata_async_take(socket_data *d)
+{
+    _async_func func = d->async;
+
+    if(d->async_fd >= 0)
+        g_set.event->del(g_set.poll, d->async_fd);
+    d->async_fd = -1;
+    d->async = NULL;
+    return func;
+}
+
+/* suspend the request, see _httpd_suspend. */
+int vohttpd_async_suspend(socket_data *d, int fd, uint events, uint secs, _async_func func)
+{
+    // blocking function, the loop calls func when it returns.
+    if(g_job != NULL) {
+        if(g_job != d || d->async != NULL || func == NULL || fd >= 0 || secs > 0)
+            return -1;
+        d->async = func;
+        return 0;
+    }
+    if(d->async != NULL || func == NULL || d->sock < 0)
         return -1;
-    while(*e != ' ' && e != p)
-        e--;
-    if(e == p)
+
+    // the pointer is tagged, socket_data is never at an odd address.
+    events &= EVENT_READ | EVENT_WRITE;
+    if(fd >= 0 && g_set.event->add(g_set.poll, fd, events, (char *)d + 1) < 0)
         return -1;
+    d->async = func;
+    d->async_fd = fd;
+    if(secs > 0 || fd < 0)
+        socketdata_wait(d, SOCKET_WAIT_ASYNC, secs);
+    else
+        timer_del(&d->timer);
+    return 0;
+}
 
-    *e = '\0';
-    f1 = strstr(p, HTTP_CGI_BIN);
-    *e = ' ';
+void socketdata_delete(socket_table *socks, int sock)
+{
+    socket_data *d;
 
-    ret = 0;
-    if(f1 != NULL) {
-        f1 += sizeof(HTTP_CGI_BIN) - 1;
+    d = socket_table_get(socks, sock);
+    if(d == NULL)
+        return;
 
-        fn->ref = f1;
-        fn->size = e - f1;
+    g_set.event->del(g_set.poll, sock);
+    close(sock);
+    if(d->stream && d->stream->abort)
+        d->stream->abort(d);    // body stream is not finished.
+    if(d->async)
+        socketdata_async_take(d)(d, EVENT_CLOSED);
+    socketdata_queue_free(d);
+    socketdata_free_body(d);
+    socketdata_unparse(d);
+    vohttpd_arena_reset(d);
+    d->used = 0;
+    socketdata_release(d);
+    safe_free(d->in_heap);
+    d->in = NULL;
+    d->in_size = 0;
+
+    timer_del(&d->timer);
+    d->sock = -1;
+    socks->node[sock] = NULL;
+    socks->count--;
+
+    d->next = socks->closed;
+    socks->closed = d;
+}
 
-        pa->ref = d->body;
-        pa->size = d->recv;
+/* keep-alive, clean up the request but keep the connection for next one.
+ * bytes received after current request(pipelined) move to the buffer front.
+ * return the size of these bytes.
+ */
+uint socketdata_reset(socket_data *d)
+{
+    uint left = 0;
+    char *next = NULL;
 
-        ret = 2;
+    // closing connection does not read pipelined requests.
+    if(d->type == SOCKET_DATA_STACK && d->recv > d->size && !d->close) {
+        next = d->body + d->size;
+        left = d->recv - d->size;
     }
-
-    return ret;
+    socketdata_free_body(d);
+    socketdata_unparse(d);
+    vohttpd_arena_reset(d);
+
+    if(left)
+        memmove(d->head, next, left);
+    if(d->head)
+        d->head[left] = '\0';
+
+    d->used = left;
+    d->scan = 0;
+    d->size = 0;
+    d->recv = 0;
+    d->body = NULL;
+    d->type = SOCKET_DATA_NULL;
+    d->stream = NULL;
+    d->user = NULL;
+    d->keep = 0;
+    d->count++;
+    socketdata_release(d);
+
+    // response is still queued, pipelined request has started already,
+    // or wait for next one.
+    if(d->out)
+        socketdata_wait_send(d);
+    else if(left)
+        socketdata_wait(d, SOCKET_WAIT_HEAD, HEAD_TIMEOUT);
+    else
+        socketdata_wait(d, SOCKET_WAIT_IDLE, g_set.keepalive);
+    return left;
 }
 
-// return:
-//  0: "Connection: close", close and remove socket.
-//  1: "Connection: keep-alive", wait for next request.
-int vohttpd_data_filter(socket_data *d)
+/* recv for the request, from what the backend has received if it receives
+ * by itself. the next recv starts when that is all taken, so a connection
+ * which does not read does not receive either.
+ */
+static int socketdata_recv(socket_data *d, char *buf, uint size)
 {
-    string_reference fn, pa;
-    if(memcmp(d->head, "GET", 3) == 0) {
+    if(g_set.event->recv == NULL)
+        return recv(d->sock, buf, size, MSG_DONTWAIT);
+
+    if(d->in_size > 0) {
+        size = min(size, d->in_size);
+        memcpy(buf, d->in, size);
+        d->in += size;
+        d->in_size -= size;
+        if(d->in_size == 0) {
+            safe_free(d->in_heap);
+            d->in = NULL;
+            if(d->in_end == 0)
+                g_set.event->recv(g_set.poll, d->sock, d);
+        }
+        return (int)size;
+    }
+    if(d->in_end > 0)
+        return 0;
+    errno = d->in_end < 0 ? -d->in_end : EAGAIN;
+    return -1;
+}
+
+/* data received by the backend, it is valid in this loop round only. */
+static void socketdata_input(socket_data *d, vohttpd_event *ev)
+{
+    if(d->sock < 0 || d->in_size > 0)
+        return;
+    if(ev->res > 0) {
+        d->in = ev->data;
+        d->in_size = (uint)ev->res;
+    } else {
+        d->in_end = ev->res == 0 ? 1 : ev->res;
+    }
+}
+
+/* the backend takes its buffer back, keep what the request has not read. */
+static void socketdata_input_keep(socket_data *d)
+{
+    char *p;
+
+    if(d->sock < 0 || d->in_size == 0 || d->in_heap)
+        return;
+    p = (char *)malloc(d->in_size);
+    if(p == NULL) {
+        socketdata_delete(g_set.socks, d->sock);
+        return;
+    }
+    memcpy(p, d->in, d->in_size);
+    d->in = d->in_heap = p;
+}
+
+/* find next '\n' in [p, e), return e if there is none.
+ * 32/16 bytes a step with AVX2/SSE2, byte by byte for the rest.
+ */
+const char* vohttpd_scan_line(const char *p, const char *e)
+{
+#if defined(__AVX2__)
+    const __m256i lf = _mm256_set1_epi8('\n');
+    for(; e - p >= 32; p += 32) {
+        uint m = (uint)_mm256_movemask_epi8(_mm256_cmpeq_epi8(
+                _mm256_loadu_si256((const __m256i *)p), lf));
+        if(m)
+            return p + __builtin_ctz(m);
+    }
+#elif defined(__SSE2__)
+    const __m128i lf = _mm_set1_epi8('\n');
+    for(; e - p >= 16; p += 16) {
+        uint m = (uint)_mm_movemask_epi8(_mm_cmpeq_epi8(
+                _mm_loadu_si128((const __m128i *)p), lf));
+        if(m)
+            return p + __builtin_ctz(m);
+    }
+#endif
+    for(; p < e; p++) {
+        if(*p == '\n')
+            return p;
+    }
+    return e;
+}
+
+/* find the end of request head in buf[0, size), scan starts from 'from'
+ * which is where last scan stopped, so every byte is only checked once.
+ * return the offset after "\r\n\r\n", or 0 if the head is not complete.
+ */
+uint vohttpd_scan_head(const char *buf, uint from, uint size)
+{
+    const char *p = buf + from, *e = buf + size;
+
+    // the end mark may start before 'from', every '\n' looks back.
+    while(p = vohttpd_scan_line(p, e), p < e) {
+        if(p - buf >= 3 && p[-1] == '\r' && p[-2] == '\n' && p[-3] == '\r')
+            return p + 1 - buf;
+        p++;
+    }
+    return 0;
+}
+
+/* body size by Content-Length, return 0 or the status to answer. only digits
+ * are taken, a length read wrong would leave body bytes as next request.
+ */
+int vohttpd_decode_content_size(socket_data *d, uint *size)
+{
+    string_reference v;
+    unsigned long long n;
+    char *end;
+
+    *size = 0;
+    if(!vohttpd_header_id(d, HEADER_CONTENT_LENGTH, &v))
+        return 0;
+    if(v.size == 0 || *v.ref < '0' || *v.ref > '9')
+        return 400;
+    errno = 0;
+    n = strtoull(v.ref, &end, 10);
+    if(end != v.ref + v.size)
+        return 400;
+    // the body size and the spill margin stay in uint.
+    if(errno == ERANGE || n > (unsigned long long)(uint)-1 - 2)
+        return 413;
+    *size = (uint)n;
+    return 0;
+}
+
+// HTTP/1.1 keeps the connection by default, HTTP/1.0 only if asked.
+uint vohttpd_decode_keep_alive(socket_data *d)
+{
+    string_reference v;
+
+    if(!vohttpd_header_id(d, HEADER_CONNECTION, &v))
+        return d->req->version >= 11;
+    if(v.size >= 5 && strncasecmp(v.ref, "close", 5) == 0)
+        return 0;
+    if(v.size >= 10 && strncasecmp(v.ref, "keep-alive", 10) == 0)
+        return 1;
+    return d->req->version >= 11;
+}
+
+// return FILE_ENCODING bits of precompressed files the client accepts.
+uint vohttpd_decode_accept_encoding(socket_data *d)
+{
+    string_reference v;
+    char *p, *e, *t;
+    uint accept = 0, len;
+
+    if(!vohttpd_header_id(d, HEADER_ACCEPT_ENCODING, &v))
+        return 0;
+    p = v.ref;
+    e = v.ref + v.size;
+
+    // "gzip, deflate;q=0.5, br", an encoding with q=0 is refused.
+    while(p < e) {
+        while(p < e && (*p == ' ' || *p == ','))
+            p++;
+        for(t = p; t < e && *t != ',' && *t != ';' && *t != ' '; t++);
+        len = t - p;
+
+        while(t < e && *t != ',' && *t != ';')
+            t++;
+        if(t < e && *t == ';') {
+            char *q = t;
+            while(q < e && *q != ',')
+                q++;
+            if(memmem(t, q - t, "q=0", 3) && !memmem(t, q - t, "q=0.", 4))
+                len = 0;    // q=0 without fraction, refused.
+            t = q;
+        }
+
+        if(len == 4 && strncasecmp(p, "gzip", 4) == 0)
+            accept |= FILE_ENCODING_GZIP;
+        else if(len == 2 && strncasecmp(p, "br", 2) == 0)
+            accept |= FILE_ENCODING_BR;
+        p = t;
+    }
+    return accept;
+}
+
+/* find etag in an entity-tag list: "a", W/"b", ...
+ * weak comparison, W/"x" matches "x" as If-None-Match requires.
+ */
+int vohttpd_etag_listed(const char *p, const char *end, const char *etag)
+{
+    uint len = strlen(etag);
+    const char *tag;
+
+    while(p < end) {
+        while(p < end && (*p == ' ' || *p == '\t' || *p == ','))
+            p++;
+        if(end - p >= 2 && p[0] == 'W' && p[1] == '/')
+            p += 2;
+        if(p >= end || *p != '"')
+            return 0;   // malformed, stop here.
+        tag = p;
+        p = memchr(p + 1, '"', end - p - 1);
+        if(p == NULL)
+            return 0;
+        p++;
+        if((uint)(p - tag) == len && memcmp(tag, etag, len) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+/* conditional request, the client already has the same file.
+ * If-None-Match wins, If-Modified-Since is only checked without it.
+ */
+int vohttpd_not_modified(socket_data *d, file_cache *f)
+{
+    char date[DATETIME_SIZE];
+    string_reference v;
+    struct tm tm;
+
+    if(vohttpd_header_id(d, HEADER_IF_NONE_MATCH, &v)) {
+        if(v.size == 1 && *v.ref == '*')
+            return 1;
+        return vohttpd_etag_listed(v.ref, v.ref + v.size, f->etag);
+    }
+
+    if(!vohttpd_header_id(d, HEADER_IF_MODIFIED_SINCE, &v) || v.size >= DATETIME_SIZE)
+        return 0;
+    string_reference_dup(&v, date);
+    memset(&tm, 0, sizeof(struct tm));
+    if(strptime(date, "%a, %d %b %Y %H:%M:%S GMT", &tm) == NULL)
+        return 0;
+    return (long long)timegm(&tm) >= f->mtime;
+}
+
+/* parse "Range: bytes=0-99,200-,-50" into [start, end] pairs.
+ * return count of satisfiable ranges, 0 if none is satisfiable,
+ *  < 0 if the whole file should be sent(no range, invalid, If-Range mismatch).
+ */
+int vohttpd_decode_range(socket_data *d, file_cache *f, long long *range, int max)
+{
+    string_reference v;
+    long long start, end;
+    char *p, *e;
+    int count = 0, specs = 0;
+
+    if(!vohttpd_header_id(d, HEADER_RANGE, &v) || v.size < 6 || strncasecmp(v.ref, "bytes=", 6))
+        return -1;
+
+    // If-Range, only send the part when client has the same file.
+    {
+        string_reference r;
+        if(vohttpd_header_id(d, HEADER_IF_RANGE, &r)) {
+            const char *tag = *r.ref == '"' ? f->etag : f->modified;
+            if(r.size != strlen(tag) || memcmp(r.ref, tag, r.size))
+                return -1;
+        }
+    }
+
+    p = v.ref + 6;
+    e = v.ref + v.size;
+    while(p < e) {
+        while(p < e && (*p == ' ' || *p == ','))
+            p++;
+        if(p >= e)
+            break;
+        if(++specs > max)
+            return -1;  // too many ranges, just send whole file.
+
+        if(*p == '-') {     // suffix range, last n bytes.
+            end = strtoll(p + 1, &p, 10);
+            if(end <= 0)
+                continue;
+            start = max(0, f->size - end);
+            end = f->size - 1;
+        } else {
+            if(*p < '0' || *p > '9')
+                return -1;
+            start = strtoll(p, &p, 10);
+            if(p >= e || *p != '-')
+                return -1;
+            p++;
+            // open end is the last byte, check it after start is known valid.
+            end = (p < e && *p >= '0' && *p <= '9') ? strtoll(p, &p, 10) : -1;
+            if(end >= 0 && end < start)
+                return -1;
+            if(end < 0 || end >= f->size)
+                end = f->size - 1;
+        }
+        while(p < e && *p == ' ')
+            p++;
+        if(p < e && *p != ',')
+            return -1;
+
+        if(start >= f->size)
+            continue;   // not satisfiable, skip it.
+        range[count * 2] = start;
+        range[count * 2 + 1] = end;
+        count++;
+    }
+    return count;
+}
+
+/* send file body directly from page cache to the socket, the part the
+ * socket does not take now is queued.
+ * return size, or < 0 if the socket is broken.
+ */
+long long vohttpd_send_file(socket_data *d, int fd, off_t offset, long long size)
+{
+    long long off = offset, left = size;
+    ssize_t ret;
+
+    // queued data goes first, never send around it. a backend which sends
+    // by itself takes it from the queue.
+    while(left > 0 && d->out == NULL && !d->busy && g_set.event->send == NULL) {
+        ret = socket_send_file(d->sock, fd, &off, left);
+        if(ret < 0 && errno == EINTR)
+            continue;
+        if(ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        if(ret <= 0) {
+            d->keep = 0;
+            return size > left ? size - left : -1;
+        }
+        left -= ret;
+    }
+
+    if(left > 0 && socketdata_queue_file(d, fd, off, left) < 0) {
+        d->keep = 0;
+        return size > left ? size - left : -1;
+    }
+    return size;
+}
+
+/* head lines which change with every response, and the head end. */
+int vohttpd_file_tail(socket_data *d, char *buf, int size)
+{
+    static const char keep[] = "\r\n" HTTP_CONNECTION ": keep-alive\r\n\r\n";
+    static const char quit[] = "\r\n" HTTP_CONNECTION ": close\r\n\r\n";
+    int n = sizeof(HTTP_DATE_TIME ": ") - 1;
+
+    if(size < n + HTTP_DATE_SIZE + (int)sizeof(keep))
+        return 0;
+    memcpy(buf, HTTP_DATE_TIME ": ", n);
+    memcpy(buf + n, vohttpd_date_value(&g_set), HTTP_DATE_SIZE);
+    n += HTTP_DATE_SIZE;
+    if(d->keep) {
+        memcpy(buf + n, keep, sizeof(keep));
+        return n + sizeof(keep) - 1;
+    }
+    memcpy(buf + n, quit, sizeof(quit));
+    return n + sizeof(quit) - 1;
+}
+
+/* send 206 response for ranges, multipart/byteranges if more than one.
+ * no satisfiable range(count == 0) returns 416.
+ */
+int vohttpd_http_range(socket_data *d, file_cache *f, long long *range, int count)
+{
+    char buf[SENDBUF_SIZE], part[MESSAGE_SIZE], boundary[FUNCTION_SIZE];
+    long long total = 0, sent;
+    int size, i;
+
+    if(count == 0) {
+        size = vohttpd_reply_head(buf, 416);
+        size += snprintf(buf + size, SENDBUF_SIZE - size, "%s: bytes */%lld\r\n",
+                HTTP_CONTENT_RANGE, f->size);
+        size += vohttpd_head_number(buf + size, HTTP_CONTENT_LENGTH, 0);
+        size += vohttpd_file_tail(d, buf + size, SENDBUF_SIZE - size);
+        return d->set->send(d->sock, buf, size, 0);
+    }
+
+    size = file_cache_head(f, 206, buf, SENDBUF_SIZE);
+    if(count == 1) {
+        total = range[1] - range[0] + 1;
+        size += snprintf(buf + size, SENDBUF_SIZE - size, "%s: %s\r\n%s: bytes %lld-%lld/%lld\r\n",
+                HTTP_CONTENT_TYPE, f->mime, HTTP_CONTENT_RANGE, range[0], range[1], f->size);
+    } else {
+        // every part: boundary, type, range, empty line, data. then the end boundary.
+        snprintf(boundary, FUNCTION_SIZE, "vohttpd%llx%x", f->inode, (uint)rand());
+        for(i = 0; i < count; i++) {
+            total += snprintf(part, MESSAGE_SIZE, "\r\n--%s\r\n%s: %s\r\n%s: bytes %lld-%lld/%lld\r\n\r\n",
+                    boundary, HTTP_CONTENT_TYPE, f->mime, HTTP_CONTENT_RANGE,
+                    range[i * 2], range[i * 2 + 1], f->size);
+            total += range[i * 2 + 1] - range[i * 2] + 1;
+        }
+        total += snprintf(part, MESSAGE_SIZE, "\r\n--%s--\r\n", boundary);
+        size += snprintf(buf + size, SENDBUF_SIZE - size, "%s: multipart/byteranges; boundary=%s\r\n",
+                HTTP_CONTENT_TYPE, boundary);
+    }
+    size += vohttpd_head_number(buf + size, HTTP_CONTENT_LENGTH, total);
+    size += vohttpd_file_tail(d, buf + size, SENDBUF_SIZE - size);
+
+    if(d->set->send(d->sock, buf, size, MSG_MORE) <= 0)
+        return -1;
+
+    if(count == 1) {
+        sent = vohttpd_send_file(d, f->fd, range[0], total);
+        if(sent < total)
+            d->keep = 0;
+        return sent < 0 ? -1 : (int)min(sent, 0x7fffffff);
+    }
+
+    for(i = 0; i < count; i++) {
+        size = snprintf(part, MESSAGE_SIZE, "\r\n--%s\r\n%s: %s\r\n%s: bytes %lld-%lld/%lld\r\n\r\n",
+                boundary, HTTP_CONTENT_TYPE, f->mime, HTTP_CONTENT_RANGE,
+                range[i * 2], range[i * 2 + 1], f->size);
+        total = range[i * 2 + 1] - range[i * 2] + 1;
+        if(d->set->send(d->sock, part, size, MSG_MORE) <= 0 ||
+           vohttpd_send_file(d, f->fd, range[i * 2], total) < total) {
+            d->keep = 0;
+            return -1;
+        }
+    }
+    size = snprintf(part, MESSAGE_SIZE, "\r\n--%s--\r\n", boundary);
+    return d->set->send(d->sock, part, size, 0);
+}
+
+int vohttpd_http_file(socket_data *d, const char *param)
+{
+    char buf[SENDBUF_SIZE], *p;
+    char path[MESSAGE_SIZE];
+    file_cache *f;
+    int size;
+    long long total;
+
+    // file name might contains parameter, we should cut it.
+    if(p = strchr(param, '?'), p != NULL)
+        size = min(p - param, MESSAGE_SIZE - 1);
+    else
+        size = min(strlen(param), MESSAGE_SIZE - 1);
+    memcpy(path, param, size);
+    path[size] = '\0';
+
+    // the file stays open in cache, sendfile never moves its file offset.
+    f = file_cache_encoded(d->set, path, vohttpd_decode_accept_encoding(d));
+    if(f->type != FILE_CACHE_FILE)
+        return d->set->error_page(d, 404, NULL);
+
+    // client cache is still fresh, answer from cached metadata only.
+    if(vohttpd_not_modified(d, f)) {
+        size = file_cache_head(f, 304, buf, SENDBUF_SIZE);
+        size += vohttpd_file_tail(d, buf + size, SENDBUF_SIZE - size);
+        return d->set->send(d->sock, buf, size, 0);
+    }
+
+    // partial content, for media seeking and resuming download.
+    {
+        long long range[RANGE_COUNT * 2];
+        int count = vohttpd_decode_range(d, f, range, RANGE_COUNT);
+        if(count >= 0)
+            return vohttpd_http_range(d, f, range, count);
+    }
+
+    // small file is kept in memory with prebuilt head, one writev for all.
+    if(file_cache_hot(d->set, f) == 0) {
+        struct iovec iov[3];
+        size = vohttpd_file_tail(d, buf, SENDBUF_SIZE);
+
+        iov[0].iov_base = f->data;
+        iov[0].iov_len = f->head;
+        iov[1].iov_base = buf;
+        iov[1].iov_len = size;
+        iov[2].iov_base = f->data + f->head;
+        iov[2].iov_len = (size_t)f->size;
+
+        total = d->set->sendv(d->sock, iov, 3, 0);
+        if(total < f->head + size + f->size)
+            d->keep = 0;
+        return total < 0 ? -1 : (int)total;
+    }
+
+    size = file_cache_head(f, 200, buf, SENDBUF_SIZE);
+    size += vohttpd_file_tail(d, buf + size, SENDBUF_SIZE - size);
+
+    // MSG_MORE: hold the head, it goes out in the same segment with body.
+    size = d->set->send(d->sock, buf, size, f->size > 0 ? MSG_MORE : 0);
+    if(size <= 0)
+        return -1;
+
+    total = vohttpd_send_file(d, f->fd, 0, f->size);
+    if(total < f->size)
+        d->keep = 0;    // body is broken, the client can not reuse it.
+    return total < 0 ? -1 : (int)min(total, 0x7fffffff);
+}
+
+int vohttpd_http_folder(socket_data *d, const char *path)
+{
+    char buf[SENDBUF_SIZE];
+    int size, total = 0;
+    DIR *dir;
+    struct dirent *dp;
+
+    dir = opendir(path);
+    if(dir == NULL)
+        return d->set->error_page(d, 404, "can not open the folder.");
+
+    // no content length for the folder page, end it by closing connection.
+    d->keep = 0;
+
+    size = vohttpd_reply_head(buf, 200);
+    size += vohttpd_head_line(buf + size, HTTP_CONTENT_TYPE, vohttpd_mime_map("html"));
+    size += vohttpd_file_tail(d, buf + size, SENDBUF_SIZE - size);
+    size = d->set->send(d->sock, buf, size, 0);
+
+    size = snprintf(buf, SENDBUF_SIZE, "<html><head><title>%s</title></head>"
+        "<body style=\"font-family:" HTTP_FONT "\"><h2>%s</h2><hr>", path, path);
+    total += d->set->send(d->sock, buf, size, 0);
+
+    while(dp = readdir(dir), dp) {
+        if(strcmp(dp->d_name, ".") == 0 || strcmp(dp->d_name, "..") == 0)
+            continue;
+        if(dp->d_type == DT_DIR)
+            size = snprintf(buf, SENDBUF_SIZE, "<p id=\"dir\"><b>[%s]</b><p>", dp->d_name);
+        else
+            size = snprintf(buf, SENDBUF_SIZE, "<p id=\"file\">%s</p>", dp->d_name);
+        total += d->set->send(d->sock, buf, size, 0);
+    }
+    closedir(dir);
+
+    size = snprintf(buf, SENDBUF_SIZE, "</body></html>");
+    total += d->set->send(d->sock, buf, size, 0);
+    return total;
+}
+
+int vohttpd_default(socket_data *d, string_reference *fn)
+{
+    char head[MESSAGE_SIZE];
+    char path[MESSAGE_SIZE];
+
+    if(fn->size >= MESSAGE_SIZE)
+        return d->set->error_page(d, 413, NULL);
+    string_reference_dup(fn, head);
+    if(strstr(head, ".."))
+        return d->set->error_page(d, 403, NULL);
+
+    if(fn->size > 0 && head[fn->size - 1] == '/') {
+        snprintf(path, MESSAGE_SIZE, "%s%sindex.html", g_set.base, head);
+        if(file_cache_get(d->set, path)->type == FILE_CACHE_FILE)
+            return d->set->http_file(d, path);
+        // no index.html, we show it as folder.
+    }
+
+    // the address might be a file.
+    snprintf(path, MESSAGE_SIZE, "%s%s", g_set.base, head);
+    if(file_cache_get(d->set, path)->type == FILE_CACHE_FOLDER)
+        return d->set->http_folder(d, path);
+    else
+        return d->set->http_file(d, path);
+}
+
+/* call stream plugin when the body is ready, begin and data have been
+ * called while receiving if the body was streamed.
+ */
+static int vohttpd_stream_call(socket_data *d, const plugin_stream *s)
+{
+    uint size = min(d->recv, d->size);
+
+    if(d->type != SOCKET_DATA_STREAM) {
+        if(s->begin(d, &d->req->query) < 0 ||
+           (size && s->data(d, d->body, size) < 0)) {
+            d->keep = 0;
+            return -1;
+        }
+    }
+    d->stream = NULL;   // finished, no abort from now on.
+    return s->end(d);
+}
+
+static void vohttpd_function_run(thread_job *job)
+{
+    plugin_job *j = (plugin_job *)job;
+
+    g_job = j->d;
+    j->func(j->d, &j->pa);
+    g_job = NULL;
+}
+
+/* run blocking function on the thread pool, the connection is left alone
+ * until it returns, see vohttpd_socket_resume.
+ */
+static int vohttpd_function_submit(socket_data *d, _plugin_func func, string_reference *pa)
+{
+    plugin_job *j;
+
+    j = (plugin_job *)vohttpd_arena_alloc(d, sizeof(plugin_job));
+    if(j == NULL)
+        return d->set->error_page(d, 500, NULL);
+    j->job.run = vohttpd_function_run;
+    j->d = d;
+    j->func = func;
+    j->pa = *pa;
+
+    d->busy = 1;
+    if(thread_pool_submit(d->set->pool, &j->job) < 0) {
+        d->busy = 0;
+        return d->set->error_page(d, 503, NULL);
+    }
+    timer_del(&d->timer);   // no deadline while the function runs.
+
+    j->prev = NULL;
+    j->next = g_running;
+    if(g_running)
+        g_running->prev = j;
+    g_running = j;
+    return 0;
+}
+
+/* no thread pool, run blocking function on the loop as if it were on a
+ * thread, its completion(see _httpd_suspend) follows at once.
+ */
+static int vohttpd_function_inline(socket_data *d, _plugin_func func, string_reference *pa)
+{
+    int ret;
+
+    g_job = d;
+    ret = func(d, pa);
+    g_job = NULL;
+    if(d->async == NULL)
+        return ret;
+    return socketdata_async_take(d)(d, 0);
+}
+
+int vohttpd_function(socket_data *d, string_reference *fn, string_reference *pa)
+{
+    char name[FUNCTION_SIZE];
+    func_node *n;
+
+    if(fn->size >= FUNCTION_SIZE)
+        return d->set->error_page(d, 413, NULL);
+    string_reference_dup(fn, name);
+    if(strchr(name, '.') != NULL)   // this is library handle.
+        return d->set->error_page(d, 403, NULL);
+    n = func_table_node(d->set->funcs, name);
+    if(n == NULL)
+        return d->set->error_page(d, 404, NULL);
+
+    if(n->flags & PLUGIN_STREAM)
+        return vohttpd_stream_call(d, (const plugin_stream *)n->val);
+    if((n->flags & PLUGIN_BLOCKING) && d->set->pool)
+        return vohttpd_function_submit(d, (_plugin_func)n->val, pa);
+    if(n->flags & PLUGIN_BLOCKING)
+        return vohttpd_function_inline(d, (_plugin_func)n->val, pa);
+    return ((_plugin_func)n->val)(d, pa);
+}
+
+// return:
+//  0: get header do not have special request.
+//  1: get header contains function.
+//  2: get header contains function and parameters.
+//  < 0: not a valid header.
+int vohttpd_decode_get(socket_data *d, string_reference *fn, string_reference *pa)
+{
+    http_request *r = d->req;
+    char *f1;
+
+    f1 = memmem(r->path.ref, r->path.size, HTTP_CGI_BIN, sizeof(HTTP_CGI_BIN) - 1);
+    if(f1 == NULL) {
+        *fn = r->path;
+        return 0;
+    }
+
+    f1 += sizeof(HTTP_CGI_BIN) - 1;
+    fn->ref = f1;
+    fn->size = r->path.ref + r->path.size - f1;
+    if(r->query.ref == r->path.ref + r->path.size)
+        return 1;   // no '?' in target.
+    *pa = r->query;
+    return 2;
+}
+
+int vohttpd_decode_post(socket_data *d, string_reference *fn, string_reference *pa)
+{
+    http_request *r = d->req;
+    char *f1;
+
+    f1 = memmem(r->path.ref, r->path.size, HTTP_CGI_BIN, sizeof(HTTP_CGI_BIN) - 1);
+    if(f1 == NULL)
+        return 0;
+
+    f1 += sizeof(HTTP_CGI_BIN) - 1;
+    fn->ref = f1;
+    fn->size = r->path.ref + r->path.size - f1;
+
+    pa->ref = d->body;
+    pa->size = d->recv;
+    return 2;
+}
+
+/* POST to a stream plugin, give it the body while it comes.
+ * return 1 if the body is streamed, 0 if the body should be buffered,
+ * < 0 if the connection is closed.
+ */
+static int vohttpd_stream_begin(socket_data *d)
+{
+    char name[FUNCTION_SIZE];
+    string_reference fn, pa;
+    func_node *n;
+
+    if(d->req->method != HTTP_METHOD_POST || vohttpd_decode_post(d, &fn, &pa) != 2)
+        return 0;
+    if(fn.size >= FUNCTION_SIZE)
+        return 0;
+    string_reference_dup(&fn, name);
+    n = func_table_node(g_set.funcs, name);
+    if(n == NULL || !(n->flags & PLUGIN_STREAM) || strchr(name, '.') != NULL)
+        return 0;
+
+    d->type = SOCKET_DATA_STREAM;
+    d->stream = (const plugin_stream *)n->val;
+    if(d->stream->begin(d, &d->req->query) < 0 ||
+       (d->recv && d->stream->data(d, d->body, d->recv) < 0)) {
+        socketdata_delete(g_set.socks, d->sock);
+        return -1;
+    }
+    d->body = NULL;     // the head buffer only keeps the head.
+    return 1;
+}
+
+// return:
+//  0: "Connection: close", close and remove socket.
+//  1: "Connection: keep-alive", wait for next request.
+// handlers clear d->keep if the response can not be delimited.
+int vohttpd_data_filter(socket_data *d)
+{
+    string_reference fn, pa;
+    if(d->req->method == HTTP_METHOD_GET) {
         switch(vohttpd_decode_get(d, &fn, &pa)) {
         case 0: {
             vohttpd_default(d, &fn);
@@ -381,7 +1538,7 @@ int vohttpd_data_filter(socket_data *d)
             d->set->error_page(d, 404, NULL);
             break;
         }
-    } else if(memcmp(d->head, "POST", 4) == 0) {
+    } else if(d->req->method == HTTP_METHOD_POST) {
         switch(vohttpd_decode_post(d, &fn, &pa)) {
         case 2:
             vohttpd_function(d, &fn, &pa);
@@ -394,352 +1551,1027 @@ int vohttpd_data_filter(socket_data *d)
         d->set->error_page(d, 501, NULL);
     }
 
-    return 0;
-}
+    return d->keep;
+}
+
+int vohttpd_error_page(socket_data *d, int code, const char *err)
+{
+    char head[MESSAGE_SIZE], body[MESSAGE_SIZE];
+    const char *msg;
+    int  size, total = 0;
+
+    if(err == NULL)
+        err = "Sorry, I have tried my best... :'(";
+
+    msg = vohttpd_code_message(code);
+    total = snprintf(body, MESSAGE_SIZE,
+        "<html><head><title>%s</title></head><body style=\"font-family:%s;\">"
+        "<h1 style=\"color:#0040F0\">%d %s</h1><p style=\"font-size:14px;\">%s"
+        "</p></body></html>", msg, HTTP_FONT, code, msg, err);
+
+    size = vohttpd_reply_head(head, code);
+    size += vohttpd_head_line(head + size, HTTP_CONTENT_TYPE, vohttpd_mime_map("html"));
+    size += vohttpd_head_number(head + size, HTTP_CONTENT_LENGTH, total);
+    size += vohttpd_file_tail(d, head + size, MESSAGE_SIZE - size);
+
+    size = d->set->send(d->sock, head, size, 0);
+    if(size <= 0)
+        return -1;
+    total = d->set->send(d->sock, body, total, 0);
+    if(total <= 0)
+        return -1;
+    return total + size;
+}
+
+/* the code or data at p belongs to the library loaded at base. */
+static int vohttpd_library_owns(const void *p, void *base)
+{
+    Dl_info dl;
+    return p != NULL && dladdr(p, &dl) && dl.dli_fbase == base;
+}
+
+/* requests streaming to or suspended in the library, its code is going
+ * away. the ones a pool thread still runs are left alone.
+ */
+static void vohttpd_library_drop(void *base)
+{
+    socket_data *d;
+    uint i;
+
+    for(i = 0; i < g_set.socks->max; i++) {
+        d = g_set.socks->node[i];
+        if(d && !d->busy && (vohttpd_library_owns(d->stream, base) ||
+                             vohttpd_library_owns((void *)d->async, base)))
+            socketdata_delete(g_set.socks, d->sock);
+    }
+}
+
+/* a job has returned, its memory goes with the request. */
+static void vohttpd_function_finish(plugin_job *j)
+{
+    if(j->prev)
+        j->prev->next = j->next;
+    else
+        g_running = j->next;
+    if(j->next)
+        j->next->prev = j->prev;
+}
+
+/* the function of a returned job and its completion are done, close the
+ * library if it has been unloaded and this was its last job.
+ */
+static void vohttpd_function_release(const void *func)
+{
+    plugin_closing **pc, *c;
+    _plugin_cleanup clean;
+
+    for(pc = &g_closing; (c = *pc) != NULL; pc = &c->next) {
+        if(!vohttpd_library_owns(func, c->base))
+            continue;
+        if(--c->jobs > 0)
+            return;
+        *pc = c->next;
+        vohttpd_library_drop(c->base);
+        clean = dlsym(c->handle, LIBRARY_CLEANUP);
+        if(clean)
+            clean();
+        dlclose(c->handle);
+        free(c);
+        return;
+    }
+}
+
+const char* vohttpd_unload_plugin(const char *path)
+{
+    char name[FUNCTION_SIZE];
+    void *h = NULL;
+    int  id = 0;
+
+    _plugin_query query;
+    _plugin_cleanup clean;
+    plugin_info info;
+    plugin_closing *c = NULL;
+    plugin_job *j;
+    uint jobs = 0;
+    Dl_info dl;
+
+    if(get_name_from_path(path, name, FUNCTION_SIZE) >= FUNCTION_SIZE)
+        return "library name is too long.";
+    h = func_table_get(g_set.funcs, name);
+    if(h == NULL)
+        return "library has not been loaded.";
+
+    query = dlsym(h, LIBRARY_QUERY);
+    if(query == NULL)
+        return "can not find query interface.";
+
+    // pool threads still in its code keep it open until they return.
+    if(!dladdr((void *)query, &dl))
+        dl.dli_fbase = NULL;
+    for(j = g_running; j; j = j->next)
+        jobs += vohttpd_library_owns((void *)j->func, dl.dli_fbase);
+    if(jobs && (c = (plugin_closing *)malloc(sizeof(plugin_closing))) == NULL)
+        return "plugin is busy.";
+    func_table_remove(g_set.funcs, name);
+
+    while(query(id++, &info) >= 0) {
+        void *func = dlsym(h, info.name);
+        if(func == NULL)
+            continue;       // no such interface.
+        if(func != func_table_get(g_set.funcs, info.name))
+            continue;       // not current interface.
+        func_table_remove(g_set.funcs, info.name);
+    }
+
+    if(dl.dli_fbase)
+        vohttpd_library_drop(dl.dli_fbase);
+    if(c) {
+        c->handle = h;
+        c->base = dl.dli_fbase;
+        c->jobs = jobs;
+        c->next = g_closing;
+        g_closing = c;
+        return NULL;
+    }
+
+    clean = dlsym(h, LIBRARY_CLEANUP);
+    if(clean)
+        clean();
+
+    dlclose(h);
+    return NULL;
+}
+
+/* loaded again before the unloaded one is closed, it is the same code,
+ * keep it instead of cleaning it up under the new load.
+ */
+static void vohttpd_library_reopen(void *h)
+{
+    plugin_closing **pc, *c;
+
+    for(pc = &g_closing; (c = *pc) != NULL; pc = &c->next) {
+        if(c->handle != h)
+            continue;
+        *pc = c->next;
+        dlclose(h);     // drop the reference of the old load.
+        free(c);
+        return;
+    }
+}
+
+const char* vohttpd_load_plugin(const char *path)
+{
+    char name[FUNCTION_SIZE];
+    void *h = NULL;
+    int id = 0;
+
+    _plugin_query query;
+    plugin_info info;
+
+    if(get_name_from_path(path, name, FUNCTION_SIZE) >= FUNCTION_SIZE)
+        return "library name is too long.";
+    if(strchr(name, '.') == NULL)
+        return "library name is not correct.";
+    if(func_table_get(g_set.funcs, name))
+        return "library has already loaded.";
+
+    h = dlopen(path, RTLD_NOW);
+    if(h == NULL)
+        return dlerror();
+    vohttpd_library_reopen(h);
+
+    query = dlsym(h, LIBRARY_QUERY);
+    if(query == NULL) {
+        dlclose(h);
+        return dlerror();
+    }
+
+    if(func_table_set(g_set.funcs, name, h) < 0) {
+        dlclose(h);
+        return "can not register library.";
+    }
+
+    // plugin built before flags existed does not fill them.
+    while(memset(&info, 0, sizeof(info)), query(id++, &info) >= 0) {
+        void *func = dlsym(h, info.name);
+        if(func == NULL)
+            continue;       // no such interface.
+        if(func_table_get(g_set.funcs, info.name))
+            continue;       // already exists same name interface.
+        if(func_table_set(g_set.funcs, info.name, func) < 0)
+            continue;       // name too long or out of memory.
+        func_table_node(g_set.funcs, info.name)->flags = info.flags;
+    }
+    return NULL;
+}
+
+int vohttpd_sendv(int sock, const struct iovec *iov, int count, int type)
+{
+    struct iovec vec[SENDV_COUNT];
+    struct msghdr msg;
+    int total = 0, i;
+    ssize_t size;
+    socket_data *d;
+
+    count = min(count, SENDV_COUNT);
+    memcpy(vec, iov, count * sizeof(struct iovec));
+    memset(&msg, 0, sizeof(struct msghdr));
+    msg.msg_iov = vec;
+    msg.msg_iovlen = count;
+    for(i = 0; i < count; i++)
+        total += (int)vec[i].iov_len;
+
+    // queued data goes first, never send around it. on a pool thread
+    // everything is queued, the loop sends it, so does a backend which
+    // sends by itself.
+    d = g_job ? g_job : socket_table_get(g_set.socks, sock);
+    while(msg.msg_iovlen > 0 && (d == NULL ||
+          (d->out == NULL && !d->busy && g_set.event->send == NULL))) {
+        size = sendmsg(sock, &msg, type | MSG_DONTWAIT | MSG_NOSIGNAL);
+        if(size < 0 && errno == EINTR)
+            continue;
+        if(size < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        if(size <= 0) {
+            if(d)
+                d->keep = 0;
+            return -1;
+        }
+
+        // skip the sent buffers, continue with the rest.
+        for(i = 0; i < (int)msg.msg_iovlen && size >= (ssize_t)msg.msg_iov[i].iov_len; i++)
+            size -= msg.msg_iov[i].iov_len;
+        msg.msg_iov += i;
+        msg.msg_iovlen -= i;
+        if(msg.msg_iovlen > 0) {
+            msg.msg_iov->iov_base = (char *)msg.msg_iov->iov_base + size;
+            msg.msg_iov->iov_len -= size;
+        }
+    }
+
+    // the socket is full, the rest is sent when it is writable.
+    for(i = 0; i < (int)msg.msg_iovlen; i++) {
+        if(d == NULL || socketdata_queue_data(d, (const char *)msg.msg_iov[i].iov_base,
+                (uint)msg.msg_iov[i].iov_len) < 0) {
+            if(d)
+                d->keep = 0;
+            return -1;
+        }
+    }
+    return total;
+}
+
+// type: send flags, such as MSG_MORE.
+int vohttpd_send(int sock, const void *data, int size, int type)
+{
+    struct iovec iov;
+
+    iov.iov_base = (void *)data;
+    iov.iov_len = size;
+    return vohttpd_sendv(sock, &iov, 1, type);
+}
+
+/* format Date header value, only when the second changes. */
+void vohttpd_date()
+{
+    time_t t = time(NULL);
+    struct tm tm;
+    uint next = !g_set.date_index;
+
+    if((long long)t == g_set.date_time)
+        return;
+    g_set.date_time = (long long)t;
+    strftime(g_set.date[next], DATETIME_SIZE, "%a, %d %b %Y %H:%M:%S GMT", gmtime_r(&t, &tm));
+    __atomic_store_n(&g_set.date_index, next, __ATOMIC_RELEASE);
+}
+
+/* monotonic seconds, used for connection timeout. */
+uint vohttpd_clock()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint)ts.tv_sec;
+}
+
+void vohttpd_init()
+{
+    // default parameters.
+    g_set.port = 80;
+    g_set.base = "/var/www/html";
+    g_set.worker = -1;
+    g_set.keepalive = KEEPALIVE_TIMEOUT;
+    g_set.requests = KEEPALIVE_REQUESTS;
+    g_set.send_rate = SEND_RATE;
+    g_set.body_limit = BODY_LIMIT;
+    g_set.spill_limit = SPILL_LIMIT;
+    g_set.threads = POOL_THREADS;
+
+    // alloc buffer for globle pointer(maybe make them to static is better?)
+    g_set.funcs = func_table_alloc(FUNCTION_COUNT);
+    g_set.socks = socket_table_alloc(SOCKET_TABLE_COUNT);
+    g_set.event = event_ops_find(NULL);
+    g_set.files = file_table_alloc(FILE_CACHE_COUNT, HOT_CACHE_SIZE);
+    g_set.now = vohttpd_clock();
+    g_set.timers = timer_wheel_alloc(g_set.now);
+    vohttpd_date();
+
+    // set default callback.
+    g_set.send = vohttpd_send;
+    g_set.sendv = vohttpd_sendv;
+    g_set.alloc = vohttpd_arena_alloc;
+    g_set.suspend = vohttpd_async_suspend;
+    g_set.http_filter = vohttpd_data_filter;
+    g_set.error_page = vohttpd_error_page;
+    g_set.load_plugin = vohttpd_load_plugin;
+    g_set.unload_plugin = vohttpd_unload_plugin;
+    g_set.http_file = vohttpd_http_file;
+    g_set.http_folder = vohttpd_http_folder;
+
+    // ignore the signal, or it will stop our server once client disconnected.
+    signal(SIGPIPE, SIG_IGN);
+}
+
+void vohttpd_uninit()
+{
+    func_table_free(g_set.funcs);
+    g_set.funcs = NULL;
+    socket_table_free(g_set.socks);
+    g_set.socks = NULL;
+    buffer_pool_clear();
+    file_table_free(g_set.files);
+    g_set.files = NULL;
+    timer_wheel_free(g_set.timers);
+    g_set.timers = NULL;
+}
+
+/* response of the request is done(or queued), keep or close.
+ * return -1 if the connection is closed, 1 if a pipelined request waits.
+ */
+int vohttpd_socket_done(socket_data *d, int keep)
+{
+    if(keep <= 0) {
+        if(d->out == NULL) {
+            socketdata_delete(g_set.socks, d->sock);
+            return -1;
+        }
+        d->close = 1;   // close after the queued response is sent.
+    }
+    return socketdata_reset(d) > 0;
+}
+
+int vohttpd_socket_request(socket_data *d)
+{
+    int keep;
+
+    d->keep = g_set.keepalive && d->count + 1 < g_set.requests &&
+            vohttpd_decode_keep_alive(d);
+
+    keep = g_set.http_filter(d);
+    if(d->busy || d->async)
+        return 0;   // the pool or the async function finishes it.
+    return vohttpd_socket_done(d, keep);
+}
+
+/* receive and process data of the socket until there is nothing left to read.
+ * return < 0 if the socket has been closed.
+ */
+int vohttpd_socket_read(socket_data *d)
+{
+    int size, stream, left;
+    uint end;
+    char *p;
+
+    // bytes not scanned yet are a pipelined request.
+    left = d->size == 0 && d->scan < d->used;
+
+    while(1) {
+        // response first, next request waits until it is sent.
+        if(d->out || d->busy || d->async)
+            return 0;
+
+        // body size = 0, we process the reuqest.
+        // body size != 0, we put it to buffer, wait for full body then process.
+        if(d->size == 0) {
+
+            // receive http head data, unless a pipelined request is waiting.
+            if(left == 0) {
+                // take a buffer only when data comes, grow to next class if full.
+                if(socketdata_buffer(d, d->used + 1) < 0) {
+                    g_set.error_page(d, 413, NULL);
+                    socketdata_delete(g_set.socks, d->sock);
+                    return -1;
+                }
+                size = socketdata_recv(d, d->head + d->used, d->limit - d->used - 1);
+                if(size < 0 && errno == EINTR)
+                    continue;
+                if(size < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                    socketdata_release(d);
+                    return 0;   // drained, wait for next event.
+                }
+                if(size <= 0) {
+                    socketdata_delete(g_set.socks, d->sock);
+                    return -1;
+                }
+                // first byte of next request, the head deadline starts.
+                if(d->wait == SOCKET_WAIT_IDLE)
+                    socketdata_wait(d, SOCKET_WAIT_HEAD, HEAD_TIMEOUT);
+                d->used += size;
+                d->head[d->used] = '\0';
+            }
+            left = 0;
+
+            // only check the bytes we have not checked.
+            end = vohttpd_scan_head(d->head, d->scan, d->used);
+            if(end == 0) {
+                d->scan = d->used;
+                continue;   // not get the header end, so we wait next recv.
+            }
+            p = d->head + end;
+
+            // every later step uses the parsed head.
+            size = socketdata_parse(d, end);
+            if(size != 0) {
+                d->keep = 0;
+                g_set.error_page(d, size, NULL);
+                socketdata_delete(g_set.socks, d->sock);
+                return -1;
+            }
+
+            // now check the content size.
+            d->recv = d->head + d->used - p;
+            d->body = p;
+            d->type = SOCKET_DATA_STACK;
+            size = vohttpd_decode_content_size(d, &d->size);
+            if(size != 0) {
+                d->keep = 0;
+                g_set.error_page(d, size, NULL);
+                socketdata_delete(g_set.socks, d->sock);
+                return -1;
+            }
+            if(d->size == 0 || d->recv >= d->size) {  // no content or already get full data.
+                left = vohttpd_socket_request(d);
+                if(left < 0)
+                    return -1;
+                continue;   // keep-alive, next request.
+            }
 
-int vohttpd_error_page(socket_data *d, int code, const char *err)
-{
-    char head[MESSAGE_SIZE], body[MESSAGE_SIZE];
-    const char *msg;
-    int  size, total = 0;
+            // body deadline is extended while data comes.
+            socketdata_wait(d, SOCKET_WAIT_BODY, BODY_TIMEOUT);
+
+            // stream plugin takes the body by chunks, nothing to buffer.
+            stream = vohttpd_stream_begin(d);
+            if(stream < 0)
+                return -1;
+
+            // the head buffer can not contain the body data(too big)
+            // we have to alloc memory for it.
+            if(stream == 0 && d->size - d->recv > d->limit - d->used - 1) {
+                if(d->size > g_set.body_limit) {
+                    d->keep = 0;
+                    g_set.error_page(d, 413, NULL);
+                    socketdata_delete(g_set.socks, d->sock);
+                    return -1;
+                }
 
-    if(err == NULL)
-        err = "Sorry, I have tried my best... :'(";
+                d->type = SOCKET_DATA_MMAP;
+                d->body = NULL;
+                size = socketdata_spill(d, d->recv);
+                if(size != 0) {
+                    d->keep = 0;
+                    g_set.error_page(d, size, NULL);
+                    socketdata_delete(g_set.socks, d->sock);
+                    return -1;
+                }
 
-    msg = vohttpd_code_message(code);
-    total = snprintf(body, MESSAGE_SIZE,
-        "<html><head><title>%s</title></head><body style=\"font-family:%s;\">"
-        "<h1 style=\"color:#0040F0\">%d %s</h1><p style=\"font-size:14px;\">%s"
-        "</p></body></html>", msg, HTTP_FONT, code, msg, err);
+                if(d->recv) {
+                    memcpy(d->body, p, d->recv);
+                    memset(p, 0, d->recv); // clean head, easy to debug.
+                }
+                // now we should goto body data receive process.
+            }
 
-    size = vohttpd_reply_head(head, code);
-    size += snprintf(head + size, MESSAGE_SIZE - size, "%s: %s\r\n", HTTP_CONTENT_TYPE, vohttpd_mime_map("html"));
-    size += snprintf(head + size, MESSAGE_SIZE - size, "%s: %s\r\n", HTTP_DATE_TIME, vohttpd_gmtime());
-    size += snprintf(head + size, MESSAGE_SIZE - size, "%s: %d\r\n", HTTP_CONTENT_LENGTH, total);
-    strcat(head, "\r\n"); size += 2;
+        } else {
 
-    size = d->set->send(d->sock, head, size, 0);
-    if(size <= 0)
-        return -1;
-    total = d->set->send(d->sock, body, total, 0);
-    if(total <= 0)
-        return -1;
-    return total + size;
+            char chunk[STREAM_CHUNK_SIZE];
+            char *to = d->body + d->recv;
+            uint want = d->size - d->recv;
+
+            // receive http body data, stream body only needs one chunk.
+            if(d->type == SOCKET_DATA_STREAM) {
+                to = chunk;
+                want = min(want, STREAM_CHUNK_SIZE);
+            } else if(d->type == SOCKET_DATA_MMAP) {
+                // mapped part is full, grow it.
+                if(d->recv + 1 >= d->spill) {
+                    size = socketdata_spill(d, d->recv + 2);
+                    if(size != 0) {
+                        d->keep = 0;
+                        g_set.error_page(d, size, NULL);
+                        socketdata_delete(g_set.socks, d->sock);
+                        return -1;
+                    }
+                }
+                to = d->body + d->recv;
+                want = min(want, d->spill - d->recv - 1);
+            }
+            size = socketdata_recv(d, to, want);
+            if(size < 0 && errno == EINTR)
+                continue;
+            if(size < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                return 0;
+            if(size <= 0) {
+                socketdata_delete(g_set.socks, d->sock);
+                return -1;
+            }
+            d->recv += size;
+            // want keeps one byte free, the body stays a string.
+            if(d->type != SOCKET_DATA_STREAM)
+                d->body[d->recv] = '\0';
+            socketdata_wait(d, SOCKET_WAIT_BODY, BODY_TIMEOUT);
+
+            if(d->type == SOCKET_DATA_STREAM && d->stream->data(d, chunk, size) < 0) {
+                socketdata_delete(g_set.socks, d->sock);
+                return -1;
+            }
+            if(d->recv >= d->size) {
+                if(vohttpd_socket_request(d) < 0)
+                    return -1;
+            }
+        }
+    }
 }
 
-const char* vohttpd_unload_plugin(const char *path)
+/* the socket is writable, send the queued response. once it is all sent,
+ * close the connection or go on reading.
+ */
+int vohttpd_socket_write(socket_data *d)
 {
-    char name[FUNCTION_SIZE];
-    void *h = NULL;
-    int  id = 0;
+    int ret = socketdata_flush(d);
 
-    _plugin_query query;
-    _plugin_cleanup clean;
-    plugin_info info;
+    if(ret < 0 || (ret == 0 && d->close)) {
+        socketdata_delete(g_set.socks, d->sock);
+        return -1;
+    }
+    if(ret > 0)
+        return 0;
 
-    if(get_name_from_path(path, name, FUNCTION_SIZE) >= FUNCTION_SIZE)
-        return "library name is too long.";
-    h = (void *)string_hash_get(g_set.funcs, name);
-    if(h == NULL)
-        return "library has not been loaded.";
+    g_set.event->mod(g_set.poll, d->sock, EVENT_READ, d);
+    if(d->async)
+        return 0;   // request is still suspended.
+    if(d->req)
+        socketdata_wait(d, SOCKET_WAIT_BODY, BODY_TIMEOUT);
+    else if(d->used)
+        socketdata_wait(d, SOCKET_WAIT_HEAD, HEAD_TIMEOUT);
+    else
+        socketdata_wait(d, SOCKET_WAIT_IDLE, g_set.keepalive);
+    return vohttpd_socket_read(d);
+}
 
-    query = dlsym(h, LIBRARY_QUERY);
-    if(query == NULL)
-        return "can not find query interface.";
-    string_hash_remove(g_set.funcs, name);
+/* the wait of suspended request is over, call it and finish the request
+ * unless it suspends again.
+ */
+void vohttpd_async_call(socket_data *d, uint event)
+{
+    socketdata_async_take(d)(d, event);
+    if(d->async || d->sock < 0)
+        return;
+    if(vohttpd_socket_done(d, d->keep) < 0)
+        return;
+    vohttpd_socket_read(d);     // pipelined request, unless output is queued.
+}
 
-    while(query(id++, &info) >= 0) {
-        _plugin_func func = dlsym(h, info.name);
-        if(func == NULL)
-            continue;       // no such interface.
-        if(func != (_plugin_func)string_hash_get(g_set.funcs, info.name))
-            continue;       // not current interface.
-        string_hash_remove(g_set.funcs, info.name);
+/* blocking functions have returned, finish their requests on the loop. */
+void vohttpd_socket_resume()
+{
+    thread_job *job, *next;
+    socket_data *d;
+    _plugin_func func;
+
+    for(job = thread_pool_done(g_set.pool); job; job = next) {
+        next = job->next;
+        d = ((plugin_job *)job)->d;
+        func = ((plugin_job *)job)->func;
+        vohttpd_function_finish((plugin_job *)job);
+        d->busy = 0;
+        if(d->out)
+            g_set.event->mod(g_set.poll, d->sock, EVENT_WRITE, d);
+
+        if(d->async) {
+            vohttpd_async_call(d, 0);   // its completion, on the loop.
+        } else if(vohttpd_socket_done(d, d->keep) >= 0) {
+            if(d->out)
+                vohttpd_socket_write(d);
+            else
+                vohttpd_socket_read(d);
+        }
+        vohttpd_function_release((void *)func);
     }
+}
 
-    clean = dlsym(h, LIBRARY_CLEANUP);
-    if(clean)
-        clean();
+/* client socket is ready while its request is suspended, only a closed
+ * client matters, pipelined data waits.
+ */
+void vohttpd_async_check(socket_data *d)
+{
+    char c;
+    int ret;
 
-    dlclose(h);
-    return NULL;
+    // the backend has received already, only its end tells.
+    if(g_set.event->recv) {
+        if(d->in_size == 0 && d->in_end)
+            socketdata_delete(g_set.socks, d->sock);
+        return;
+    }
+    ret = recv(d->sock, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    if(ret == 0 || (ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+        socketdata_delete(g_set.socks, d->sock);
 }
 
-const char* vohttpd_load_plugin(const char *path)
+/* new client, wait for its request. */
+void vohttpd_socket_accepted(int sock)
 {
-    char name[FUNCTION_SIZE];
-    void *h = NULL;
-    int id = 0;
-
-    _plugin_query query;
-    plugin_info info;
+    socket_data *d = socketdata_new(g_set.socks, sock);
+    int ret;
 
-    if(get_name_from_path(path, name, FUNCTION_SIZE) >= FUNCTION_SIZE)
-        return "library name is too long.";
-    if(strchr(name, '.') == NULL)
-        return "library name is not correct.";
-    if(string_hash_get(g_set.funcs, name))
-        return "library has already loaded.";
+    if(d == NULL) {
+        close(sock);  // out of memory.
+        return;
+    }
+    if(g_set.event->recv)
+        ret = g_set.event->recv(g_set.poll, sock, d);
+    else
+        ret = g_set.event->add(g_set.poll, sock, EVENT_READ, d);
+    if(ret < 0)
+        socketdata_delete(g_set.socks, sock);
+}
 
-    h = dlopen(path, RTLD_NOW);
-    if(h == NULL)
-        return dlerror();
+/* the listen socket is non-blocking, accept until its queue is empty. */
+void vohttpd_socket_accept(int socksrv)
+{
+    int sock;
 
-    query = dlsym(h, LIBRARY_QUERY);
-    if(query == NULL) {
-        dlclose(h);
-        return dlerror();
+    while(1) {
+#ifdef __linux__
+        sock = accept4(socksrv, NULL, NULL, SOCK_NONBLOCK);
+#else
+        sock = accept(socksrv, NULL, NULL);
+        if(sock >= 0)
+            fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+#endif
+        if(sock < 0) {
+            if(errno == EINTR || errno == ECONNABORTED)
+                continue;
+            return;     // EAGAIN, or out of file descriptors.
+        }
+        vohttpd_socket_accepted(sock);
     }
+}
 
-    if(string_hash_set(g_set.funcs, name, (uchar *)h) == NULL) {
-        dlclose(h);
-        return "hash is full.";
-    }
+/* tell all other workers and master to load/unload the same plugin. */
+void vohttpd_worker_broadcast(int type, const char *path)
+{
+    worker_message msg;
+    int i;
 
-    while(query(id++, &info) >= 0) {
-        _plugin_func func = dlsym(h, info.name);
-        if(func == NULL)
-            continue;       // no such interface.
-        if(string_hash_get(g_set.funcs, info.name))
-            continue;       // already exists same name interface.
-        if(!string_hash_set(g_set.funcs, info.name, (uchar *)func))
-            continue;       // hash full?
+    memset(&msg, 0, sizeof(worker_message));
+    msg.type = type;
+    strncpy(msg.path, path, MESSAGE_SIZE - 1);
+
+    // message size < PIPE_BUF, so the write is atomic.
+    for(i = 0; i <= g_set.workers; i++) {
+        if(i == g_set.worker)
+            continue;
+        write(g_pipes[i][1], &msg, sizeof(worker_message));
     }
-    return NULL;
 }
 
-int vohttpd_send(int sock, const void *data, int size, int type)
+const char* vohttpd_worker_load_plugin(const char *path)
 {
-    return send(sock, data, size, 0);
+    const char *errstr = vohttpd_load_plugin(path);
+    if(errstr == NULL)
+        vohttpd_worker_broadcast(WORKER_LOAD_PLUGIN, path);
+    return errstr;
 }
 
-void vohttpd_init()
+const char* vohttpd_worker_unload_plugin(const char *path)
 {
-    // default parameters.
-    g_set.port = 80;
-    g_set.base = "/var/www/html";
-
-    // alloc buffer for globle pointer(maybe make them to static is better?)
-    g_set.funcs = string_hash_alloc(FUNCTION_SIZE, FUNCTION_COUNT);
-    g_set.socks = linear_hash_alloc(sizeof(socket_data), BUFFER_COUNT);
+    const char *errstr = vohttpd_unload_plugin(path);
+    if(errstr == NULL)
+        vohttpd_worker_broadcast(WORKER_UNLOAD_PLUGIN, path);
+    return errstr;
+}
 
-    // set default callback.
-    g_set.send = vohttpd_send;
-    g_set.http_filter = vohttpd_data_filter;
-    g_set.error_page = vohttpd_error_page;
-    g_set.load_plugin = vohttpd_load_plugin;
-    g_set.unload_plugin = vohttpd_unload_plugin;
-    g_set.http_file = vohttpd_http_file;
-    g_set.http_folder = vohttpd_http_folder;
+/* apply messages from other workers, return < 0 if the pipe is broken. */
+int vohttpd_worker_message(int fd)
+{
+    worker_message msg;
+    int size;
 
-    // ignore the signal, or it will stop our server once client disconnected.
-    signal(SIGPIPE, SIG_IGN);
+    while(1) {
+        size = read(fd, &msg, sizeof(worker_message));
+        if(size < 0 && errno == EINTR)
+            continue;
+        if(size != sizeof(worker_message))
+            return size < 0 && errno == EAGAIN ? 0 : -1;
+
+        msg.path[MESSAGE_SIZE - 1] = '\0';
+        if(msg.type == WORKER_LOAD_PLUGIN)
+            vohttpd_load_plugin(msg.path);
+        else if(msg.type == WORKER_UNLOAD_PLUGIN)
+            vohttpd_unload_plugin(msg.path);
+    }
 }
 
-void vohttpd_uninit()
+/* connection deadline passed, a client which has sent part of a request
+ * gets 408, a slow client which still reads at send_rate gets more time,
+ * all others are just closed.
+ */
+void vohttpd_socket_expire(timer_node *n)
 {
-    safe_free(g_set.funcs);
-    safe_free(g_set.socks);
+    socket_data *d = (socket_data *)((char *)n - offsetof(socket_data, timer));
+
+    if(d->wait == SOCKET_WAIT_ASYNC && d->async) {
+        vohttpd_async_call(d, 0);
+        return;
+    }
+
+    // the kernel buffer drains without a writable event for a slow client.
+    if(d->wait == SOCKET_WAIT_SEND && d->out && socketdata_taken(d) - d->taken >=
+       max((long long)g_set.send_rate * SEND_TIMEOUT, 1)) {
+        socketdata_wait_send(d);
+        return;
+    }
+
+    if(d->wait == SOCKET_WAIT_HEAD && d->used > 0) {
+        d->keep = 0;
+        g_set.error_page(d, 408, NULL);
+    }
+    socketdata_delete(g_set.socks, d->sock);
 }
 
-void vohttpd_loop()
+int vohttpd_loop()
 {
-    int socksrv, sockmax, sock, b = 1, count, size;
-    uint i;
-    char *p;
+    int socksrv, b = 1, count, i;
 
     struct sockaddr_in addr;
-    socklen_t len;
-    struct timeval tmv;
-    fd_set fdr;
+    vohttpd_event ev[EVENT_COUNT];
     socket_data *d;
 
     memset(&addr, 0, sizeof(struct sockaddr_in));
     addr.sin_family = AF_INET;
     addr.sin_addr.s_addr = INADDR_ANY;
     addr.sin_port = htons(g_set.port);
-    len = sizeof(struct sockaddr_in);
 
     socksrv = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
     setsockopt(socksrv, SOL_SOCKET, SO_REUSEADDR, (const char *)&b, sizeof(int));
+#ifdef SO_REUSEPORT
+    // every worker has its own listen socket, kernel balances between them.
+    if(g_set.workers > 0)
+        setsockopt(socksrv, SOL_SOCKET, SO_REUSEPORT, (const char *)&b, sizeof(int));
+#endif
     if(bind(socksrv, (struct sockaddr*)&addr, sizeof(struct sockaddr)) < 0) {
         printf("can not bind to address, %d:%s.\n", errno, strerror(errno));
-        return;
+        close(socksrv);
+        return -1;
     }
 
-    // we can not handle much request at same time, so limit listen backlog.
-    if(listen(socksrv, min(SOMAXCONN, BUFFER_COUNT / 2)) < 0) {
+    // socket table grows with load, let the kernel queue as many as it allows.
+    if(listen(socksrv, SOMAXCONN) < 0) {
         printf("can not listen to port, %d:%s.\n", errno, strerror(errno));
-        return;
+        close(socksrv);
+        return -1;
+    }
+    fcntl(socksrv, F_SETFL, fcntl(socksrv, F_GETFL) | O_NONBLOCK);
+
+    // listen socket is added with NULL pointer, all others are socket_data.
+    // a backend which accepts by itself hands over the clients.
+    g_set.poll = g_set.event->create();
+    if(g_set.poll == NULL || (g_set.event->accept ?
+       g_set.event->accept(g_set.poll, socksrv, NULL) :
+       g_set.event->add(g_set.poll, socksrv, EVENT_READ | EVENT_SHARED, NULL)) < 0) {
+        printf("can not init %s event, %d:%s.\n", g_set.event->name, errno, strerror(errno));
+        close(socksrv);
+        return -1;
     }
 
-    // for simple embed server, my choice is select for better compatible.
-    // but for heavy load situation in linux, better to change this to epoll.
-    while(1) {
-        FD_ZERO(&fdr);
-        FD_SET(socksrv, &fdr);
-
-        // queue the hash and pickout the max socket.
-        sockmax = socksrv;
-        for(i = 0; i < g_set.socks->max; i++) {
-            d = (socket_data *)linear_hash_val(g_set.socks, i);
-            sockmax = max(d->sock, sockmax);
-            if(d->sock != (int)LINEAR_HASH_NULL)
-                FD_SET(d->sock, &fdr);
+    // plugin messages from other workers, the pipe itself is the pointer.
+    if(g_set.worker >= 0)
+        g_set.event->add(g_set.poll, g_pipes[g_set.worker][0], EVENT_READ, g_pipes[g_set.worker]);
+
+    // threads are created here, workers are forked before.
+    if(g_set.threads > 0) {
+        g_set.pool = thread_pool_alloc(g_set.threads, POOL_QUEUE_SIZE);
+        if(g_set.pool == NULL ||
+           g_set.event->add(g_set.poll, thread_pool_fd(g_set.pool), EVENT_READ, g_set.pool) < 0) {
+            printf("can not start thread pool, blocking functions run inline.\n");
+            thread_pool_free(g_set.pool);
+            g_set.pool = NULL;
         }
+    }
 
-        tmv.tv_sec = TIMEOUT / 1000;
-        tmv.tv_usec = TIMEOUT % 1000 * 1000;
+    while(1) {
+        count = g_set.event->wait(g_set.poll, ev, EVENT_COUNT, 1000);
+        g_set.now = vohttpd_clock();
+        vohttpd_date();
+
+        for(i = 0; i < count; i++) {
+            if(ev[i].ptr == NULL) {
+                if(ev[i].events & EVENT_ACCEPT)
+                    vohttpd_socket_accepted(ev[i].res);
+                else
+                    vohttpd_socket_accept(socksrv);
+                continue;
+            }
+            if(g_set.worker >= 0 && ev[i].ptr == g_pipes[g_set.worker]) {
+                if(vohttpd_worker_message(g_pipes[g_set.worker][0]) < 0)
+                    goto exit;  // pipe is broken.
+                continue;
+            }
+            if(ev[i].ptr == g_set.pool) {
+                vohttpd_socket_resume();
+                continue;
+            }
+            if((uintptr_t)ev[i].ptr & 1) {
+                // fd of a suspended request.
+                d = (socket_data *)((char *)ev[i].ptr - 1);
+                if(d->sock >= 0 && d->async && d->async_fd >= 0)
+                    vohttpd_async_call(d, ev[i].events);
+                continue;
+            }
 
-        count = select(sockmax + 1, &fdr, NULL, NULL, &tmv);
-        if(count <= 0) {
-            // clean up all sockets, they are time out.
-            for(i = 0; i < g_set.socks->max; i++) {
-                d = (socket_data *)linear_hash_val(g_set.socks, i);
-                if(d->sock == (int)LINEAR_HASH_NULL)
-                    continue;
+            d = (socket_data *)ev[i].ptr;
+            if(ev[i].events & EVENT_DATA)
+                socketdata_input(d, &ev[i]);
+            if((ev[i].events & EVENT_SENT) && d->sock >= 0 &&
+               socketdata_sent(d, ev[i].res) < 0)
                 socketdata_delete(g_set.socks, d->sock);
+            // closed, or a pool thread owns it.
+            if(d->sock >= 0 && !d->busy) {
+                if(d->out || (ev[i].events & EVENT_SENT))
+                    vohttpd_socket_write(d);
+                else if(d->async)
+                    vohttpd_async_check(d);
+                else
+                    vohttpd_socket_read(d);
             }
-            continue;
+            if(ev[i].events & EVENT_DATA)
+                socketdata_input_keep(d);
         }
 
-        if(FD_ISSET(socksrv, &fdr)) {
-            count--;
-            memset(&addr, 0, sizeof(struct sockaddr_in));
+        // expire connection deadlines, one wheel tick per second passed.
+        timer_expire(g_set.timers, g_set.now, vohttpd_socket_expire);
 
-            sock = accept(socksrv, (struct sockaddr*)&addr, &len);
-            if(socketdata_new(g_set.socks, sock) == NULL)
-                close(sock);
-        }
+        // do some clean up for next loop.
+        socket_table_flush(g_set.socks);
+    }
 
-        for(i = 0; i < g_set.socks->max; i++) {
-            if(count <= 0)
-                break;
+exit:
+    thread_pool_free(g_set.pool);
+    g_set.pool = NULL;
+    g_set.event->destroy(g_set.poll);
+    close(socksrv);
+    return 0;
+}
 
-            d = (socket_data *)linear_hash_val(g_set.socks, i);
-            if((uint)d->sock == LINEAR_HASH_NULL)
-                continue;
+/* fork a worker, the child never returns. */
+pid_t vohttpd_worker_spawn(int id)
+{
+    pid_t pid;
+    int i;
+
+    pid = fork();
+    if(pid != 0)
+        return pid;
+
+    g_set.worker = id;
+    signal(SIGTERM, SIG_DFL);
+    signal(SIGINT, SIG_DFL);
+    for(i = 0; i <= g_set.workers; i++) {
+        if(i != id)
+            close(g_pipes[i][0]);
+    }
+    fcntl(g_pipes[id][0], F_SETFL, fcntl(g_pipes[id][0], F_GETFL) | O_NONBLOCK);
+
+    if(g_set.affinity) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(id % max(1, sysconf(_SC_NPROCESSORS_ONLN)), &cpus);
+        if(sched_setaffinity(0, sizeof(cpu_set_t), &cpus) < 0)
+            printf("worker %d can not set cpu affinity, %d:%s.\n", id, errno, strerror(errno));
+    }
 
-            if(FD_ISSET(d->sock, &fdr)) {
-                count--;
+    i = vohttpd_loop();
+    vohttpd_uninit();
+    exit(i < 0 ? 1 : 0);
+}
 
-                // body size = 0, we process the reuqest.
-                // body size != 0, we put it to buffer, wait for full body then process.
-                if(d->size == 0) {
+void vohttpd_master_stop(int sig)
+{
+    g_stop = sig;
+}
 
-                    // receive http head data.
-                    size = recv(d->sock, d->head + d->used, RECVBUF_SIZE - d->used, 0);
-                    if(size <= 0) {
-                        socketdata_delete(g_set.socks, d->sock);
-                        continue;
-                    }
-                    d->used += size;
-
-                    // FIXME: we do not have to check from beginning every time.
-                    // if new recv size > 4, we can check new recv.
-                    p = strstr(d->head, HTTP_HEADER_END);
-                    if(p == NULL) {
-                        // we have filled the buffer but still not get the end of head,
-                        // the head size exceeds the allowed size, return error.
-                        if(d->used >= RECVBUF_SIZE) {
-                            g_set.error_page(d, 413, NULL);
-                            socketdata_delete(g_set.socks, d->sock);
-                        }
-                        // not get the header end, so we wait next recv.
-                        continue;
-                    }
+/* master keeps the plugin set in sync and respawns crashed workers. */
+int vohttpd_master()
+{
+    pid_t pids[WORKER_COUNT], pid;
+    int i, alive = 0, status;
+    struct timeval tmv;
+    fd_set fdr;
 
-                    p += sizeof(HTTP_HEADER_END) - 1;
+    for(i = 0; i <= g_set.workers; i++) {
+        if(pipe(g_pipes[i]) < 0) {
+            printf("can not create worker pipe, %d:%s.\n", errno, strerror(errno));
+            return -1;
+        }
+        // never block the sender, a dead worker's pipe might be full.
+        fcntl(g_pipes[i][1], F_SETFL, fcntl(g_pipes[i][1], F_GETFL) | O_NONBLOCK);
+    }
 
-                    // now check the content size.
-                    d->recv = d->head + d->used - p;
-                    d->body = p;
-                    d->type = SOCKET_DATA_STACK;
-                    d->size = vohttpd_decode_content_size(d);
-                    if(d->size == 0 || d->recv >= d->size) {  // no content or already get full data.
-                        g_set.http_filter(d);
-                        socketdata_delete(g_set.socks, d->sock);
-                        // no body in this http request, it should be GET.
-                        continue;
-                    }
+    g_set.load_plugin = vohttpd_worker_load_plugin;
+    g_set.unload_plugin = vohttpd_worker_unload_plugin;
+    fflush(stdout);
 
-                    // the head buffer can not contain the body data(too big)
-                    // we have to alloc memory for it.
-                    if(d->size - d->recv > RECVBUF_SIZE - d->used) {
-                        char map[MESSAGE_SIZE];
-                        int  fd;
-
-                        // create empty file for mmap.
-                        snprintf(map, MESSAGE_SIZE, "%s" HTTP_CGI_BIN MMAP_FILE_NAME, d->set->base, d->sock);
-                        fd = open(map, O_RDWR | O_CREAT, S_IRWXU);
-                        if(fd < 0) {
-                            g_set.error_page(d, 413, strerror(errno));
-                            socketdata_delete(g_set.socks, d->sock);
-                            continue;
-                        }
-
-                        // resize the file, or mmap pointer might fail.
-                        lseek(fd, d->size - 1, SEEK_SET);
-                        write(fd, "\0", 1);     // set file size to d->size.
-
-                        // clear up in function socketdata_delete.
-                        d->body = mmap(NULL, d->size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
-                        close(fd);
-
-                        if(d->body == MAP_FAILED) {
-                            g_set.error_page(d, 413, strerror(errno));
-                            socketdata_delete(g_set.socks, d->sock);
-                            continue;
-                        }
-                        d->type = SOCKET_DATA_MMAP;
-
-                        if(d->recv) {
-                            memcpy(d->body, p, d->recv);
-                            memset(p, 0, d->recv); // clean head, easy to debug.
-                        }
-                        // now we should goto body data receive process.
-                    }
+    // stop all workers together with master.
+    signal(SIGTERM, vohttpd_master_stop);
+    signal(SIGINT, vohttpd_master_stop);
 
-                } else {
+    for(i = 0; i < g_set.workers; i++) {
+        pids[i] = vohttpd_worker_spawn(i);
+        if(pids[i] > 0)
+            alive++;
+    }
 
-                    // receive http body data.
-                    size = recv(d->sock, d->body + d->recv, d->size - d->recv, 0);
-                    if(size <= 0) {
-                        socketdata_delete(g_set.socks, d->sock);
-                        continue;
-                    }
-                    d->recv += size;
+    while(alive > 0) {
+        if(g_stop) {
+            for(i = 0; i < g_set.workers; i++) {
+                if(pids[i] > 0)
+                    kill(pids[i], SIGTERM);
+            }
+            while(wait(NULL) > 0);
+            break;
+        }
 
-                    if(d->recv >= d->size) {
-                        g_set.http_filter(d);
-                        socketdata_delete(g_set.socks, d->sock);
-                        continue;
-                    }
-                }
+        FD_ZERO(&fdr);
+        FD_SET(g_pipes[g_set.workers][0], &fdr);
+        tmv.tv_sec = 1;
+        tmv.tv_usec = 0;
+        if(select(g_pipes[g_set.workers][0] + 1, &fdr, NULL, NULL, &tmv) > 0) {
+            worker_message msg;
+            if(read(g_pipes[g_set.workers][0], &msg, sizeof(worker_message)) == sizeof(worker_message)) {
+                msg.path[MESSAGE_SIZE - 1] = '\0';
+                if(msg.type == WORKER_LOAD_PLUGIN)
+                    vohttpd_load_plugin(msg.path);
+                else if(msg.type == WORKER_UNLOAD_PLUGIN)
+                    vohttpd_unload_plugin(msg.path);
             }
         }
 
-        // do some clean up for next loop.
-    }
+        while(pid = waitpid(-1, &status, WNOHANG), pid > 0) {
+            for(i = 0; i < g_set.workers; i++) {
+                if(pids[i] == pid)
+                    break;
+            }
+            if(i == g_set.workers)
+                continue;
 
-    close(socksrv);
+            // worker failed to start(exit code != 0), do not try again.
+            pids[i] = -1;
+            alive--;
+            if(WIFEXITED(status))
+                continue;
+
+            printf("worker %d(%d) is killed by signal %d, restart.\n", i, pid, WTERMSIG(status));
+            fflush(stdout);
+            pids[i] = vohttpd_worker_spawn(i);
+            if(pids[i] > 0)
+                alive++;
+        }
+    }
+    return 0;
 }
 
 void vohttpd_show_status()
 {
-    uint i, pos, count = 0;
+    uint i, count = 0;
 
     printf("PORT:\t%d\n", g_set.port);
     printf("PATH:\t%s\n", g_set.base);
+    printf("EVENT:\t%s\n", g_set.event->name);
+    printf("KEEP:\t%us, %u requests\n", g_set.keepalive, g_set.requests);
+    printf("SEND:\t%u bytes/s at least\n", g_set.send_rate);
+    printf("CACHE:\t%uKB\n", g_set.files->limit / 1024);
+    printf("BODY:\t%uMB, %lluMB in total\n", g_set.body_limit >> 20, g_set.spill_limit >> 20);
+    if(g_set.workers > 0)
+        printf("WORKERS:%d%s\n", g_set.workers, g_set.affinity ? ", cpu affinity" : "");
+    printf("THREADS:%u\n", g_set.threads);
 
     printf("PLUGINS:\n");
     for(i = 0; i < g_set.funcs->max; i++) {
-        pos = i * g_set.funcs->unit;
-        if(string_hash_empty(g_set.funcs, pos))
+        if(func_table_empty(g_set.funcs, i))
             continue;
-        if(!strchr(string_hash_key(g_set.funcs, pos), '.'))
+        if(!strchr(func_table_key(g_set.funcs, i), '.'))
             continue;
-        printf("\t%s\n", string_hash_key(g_set.funcs, pos));
+        printf("\t%s\n", func_table_key(g_set.funcs, i));
         count++;
     }
     if(count == 0)
@@ -748,17 +2580,29 @@ void vohttpd_show_status()
 
 void vohttpd_show_usage()
 {
-    printf("usage: vohttpd [-bdhp?]\n\n");
+    printf("usage: vohttpd [-abdeghklmprtw?]\n\n");
     printf("example: vohttpd -d/var/www/html/cgi-bin/votest.so -p8080\n");
-    printf("\t-b[path]  set www home/base folder, default /var/www/html.\n"
+    printf("\t-a        pin every worker to its own cpu.\n"
+           "\t-b[path]  set www home/base folder, default /var/www/html.\n"
            "\t-d[path]  preload plugin.\n"
+           "\t-e[name]  event backend, epoll, uring or select, default epoll on linux.\n"
+           "\t-g[MB]    memory for all buffered request bodies, default 512.\n"
            "\t-h,-?     show this usage.\n"
+           "\t-k[secs]  keep-alive idle timeout, default 5, 0 to disable.\n"
+           "\t-l[MB]    max buffered body of one request, default 128.\n"
+           "\t-m[KB]    memory for small file responses, default 1024, 0 to disable.\n"
            "\t-p[port]  set server listen port, default 8080.\n"
+           "\t-r[count] max requests per keep-alive connection, default 100.\n"
+           "\t-s[bytes] min bytes/s a slow client must read, default 1024, 0: any.\n"
+           "\t-t[count] threads for blocking plugin functions, default 4, 0: inline.\n"
+           "\t-w[count] run in worker mode, each worker has its own loop.\n"
            "\n");
 }
 
 int main(int argc, char *argv[])
 {
+    void *poll;
+
     vohttpd_init();
 
     while(argc--) {
@@ -781,6 +2625,49 @@ int main(int argc, char *argv[])
             g_set.base = argv[argc] + 2;
             break;
 
+        case 'e':   // event backend.
+            if(event_ops_find(argv[argc] + 2) != NULL)
+                g_set.event = event_ops_find(argv[argc] + 2);
+            else
+                printf("event backend %s is not supported.\n", argv[argc] + 2);
+            break;
+
+        case 'k':   // keep-alive timeout.
+            g_set.keepalive = (uint)atoi(argv[argc] + 2);
+            break;
+
+        case 's':   // min read rate of slow client.
+            g_set.send_rate = (uint)atoi(argv[argc] + 2);
+            break;
+
+        case 'l':   // max buffered body of one request.
+            g_set.body_limit = (uint)min(atoi(argv[argc] + 2), 4095) << 20;
+            break;
+
+        case 'g':   // memory for all buffered bodies.
+            g_set.spill_limit = (unsigned long long)atoi(argv[argc] + 2) << 20;
+            break;
+
+        case 'm':   // hot file cache size.
+            g_set.files->limit = (uint)atoi(argv[argc] + 2) * 1024;
+            break;
+
+        case 'r':   // max requests per connection.
+            g_set.requests = (uint)atoi(argv[argc] + 2);
+            break;
+
+        case 't':   // thread pool size.
+            g_set.threads = (uint)max(0, min(POOL_THREAD_MAX, atoi(argv[argc] + 2)));
+            break;
+
+        case 'w':   // worker process count.
+            g_set.workers = max(0, min(WORKER_COUNT, atoi(argv[argc] + 2)));
+            break;
+
+        case 'a':   // pin workers to cpus.
+            g_set.affinity = 1;
+            break;
+
         case 'h':
         case '?':
             vohttpd_show_usage();
@@ -788,9 +2675,22 @@ int main(int argc, char *argv[])
         }
     }
 
+    // the kernel decides if the backend works, try it once before workers.
+    poll = g_set.event->create();
+    if(poll == NULL) {
+        printf("%s event is not available, use %s.\n", g_set.event->name,
+               event_ops_find(NULL)->name);
+        g_set.event = event_ops_find(NULL);
+    } else {
+        g_set.event->destroy(poll);
+    }
+
     vohttpd_show_status();
 
-    vohttpd_loop();
+    if(g_set.workers > 0)
+        vohttpd_master();
+    else
+        vohttpd_loop();
     vohttpd_uninit();
     return 0;
 }
@@ -1,16 +1,34 @@
 #ifndef VOHTTPD_H
 #define VOHTTPD_H
 
+#include <sys/uio.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-#define RECVBUF_SIZE        4096
+#define RECVBUF_SIZE        4096    // smallest receive buffer, 4 times larger per class.
+#define RECVBUF_CLASS       3       // 4K, 16K, 64K, the largest request head allowed.
+#define RECVBUF_FREE_COUNT  64      // released buffers kept for reuse per class.
 #define SENDBUF_SIZE        4096
 #define MESSAGE_SIZE        256
-#define BUFFER_COUNT        12
+#define SOCKET_TABLE_COUNT  64      // initial connection slots, grows on demand.
+#define SOCKET_FREE_COUNT   256     // released connections kept for reuse.
 #define FUNCTION_SIZE       32
 #define FUNCTION_COUNT      256
+#define EVENT_COUNT         64
+#define WORKER_COUNT        64
+#define FILE_CACHE_COUNT    256
+#define FILE_CACHE_WAYS     4
+#define FILE_CACHE_TTL      1       // seconds before stat the file again.
+#define HOT_CACHE_SIZE      (1024 * 1024)
+#define HOT_FILE_SIZE       (128 * 1024)
+#define SENDV_COUNT         16
+#define HEADER_COUNT        64      // max header lines of one request.
+#define ARENA_CHUNK_SIZE    (16 * 1024) // pooled request arena chunk.
+#define ARENA_FREE_COUNT    64      // released arena chunks kept for reuse.
+#define TIMER_SLOTS         64      // slots per timer wheel level, power of 2.
+#define TIMER_LEVELS        2
 
 #define LIBRARY_QUERY       "vohttpd_library_query"
 #define LIBRARY_CLEANUP     "vohttpd_library_cleanup"
@@ -20,10 +38,24 @@ extern "C" {
 #define HTTP_CONTENT_TYPE   "Content-Type"
 #define HTTP_DATE_TIME      "Date"
 #define HTTP_CONNECTION     "Connection"
+#define HTTP_CONTENT_ENCODING "Content-Encoding"
+#define HTTP_ACCEPT_ENCODING  "Accept-Encoding"
+#define HTTP_ETAG           "ETag"
+#define HTTP_LAST_MODIFIED  "Last-Modified"
+#define HTTP_CACHE_CONTROL  "Cache-Control"
+#define HTTP_IF_NONE_MATCH  "If-None-Match"
+#define HTTP_IF_MODIFIED_SINCE "If-Modified-Since"
+#define HTTP_RANGE          "Range"
+#define HTTP_IF_RANGE       "If-Range"
+#define HTTP_CONTENT_RANGE  "Content-Range"
+#define HTTP_ACCEPT_RANGES  "Accept-Ranges"
+#define DATETIME_SIZE       32
+#define RANGE_COUNT         8       // max ranges in one request.
 #define HTTP_CGI_BIN        "/cgi-bin/"
-#define MMAP_FILE_NAME      "mmap.%d"
 
-#define vohttpd_unused(p)   ((void *)p)
+#define vohttpd_unused(p)   ((void)(p))
+#define vohttpd_date_value(set) \
+                            ((set)->date[__atomic_load_n(&(set)->date_index, __ATOMIC_ACQUIRE)])
 #define safe_free(p)        if(p) { free(p); p = NULL; }
 
 typedef unsigned char uchar;
@@ -32,33 +64,36 @@ typedef unsigned int  uint;
 #define max(a, b)           ((a) > (b) ? (a) : (b))
 #define min(a, b)           ((a) < (b) ? (a) : (b))
 
-/* linear hash, every unit must start with its key. */
-typedef struct _linear_hash {
-    uint   unit;            // the size for each unit.
-    uint   max;             // the max allowed unit.
-
-    uchar  data[1];         // data buffer.
-}linear_hash;
-typedef linear_hash string_hash;
-
-#define LINEAR_HASH_NULL         ((uint)(-1))
-#define linear_hash_empty(h, p)  (linear_hash_key((h), (p)) == LINEAR_HASH_NULL)
-#define linear_hash_clear(h, p)  {linear_hash_key((h), (p)) = LINEAR_HASH_NULL;}
-#define string_hash_empty(h, p)  (*string_hash_key((h), (p)) == '\0')
-#define string_hash_clear(h, p)  {*string_hash_key((h), (p)) = '\0';}
-#define linear_hash_key(h, p)    (*(uint *)((h)->data + (p) * (h)->unit))
-#define linear_hash_val(h, p)    ((h)->data + (p) * (h)->unit)
-#define string_hash_key(h, p)    ((char *)(((h)->data + (p)) + sizeof(uchar *)))
-#define string_hash_val(h, p)    (*((uchar **)((h)->data + (p))))
-
-extern linear_hash* linear_hash_alloc(uint unit, uint max);
-extern uchar* linear_hash_get(linear_hash *lh, uint key);
-extern uchar* linear_hash_set(linear_hash *lh, uint key);
-extern void linear_hash_remove(linear_hash *lh, uint key);
-extern string_hash* string_hash_alloc(uint unit, uint max);
-extern uchar* string_hash_get(string_hash *sh, const char *key);
-extern uchar* string_hash_set(string_hash *sh, const char *key, uchar *value);
-extern void string_hash_remove(string_hash *sh, const char *key);
+extern uint string_hash_from(const char *str);
+
+/* function registry, open addressing with stored hash and inline key.
+ * removal shifts the following nodes back, so no probe chain is broken
+ * and a miss stops at the first empty node.
+ */
+typedef struct _func_node {
+    uint   hash;            // 0: empty node.
+    uint   size;            // key length.
+    uint   flags;           // PLUGIN_FLAG of the function.
+    void*  val;
+    char   key[FUNCTION_SIZE];
+} func_node;
+
+typedef struct _func_table {
+    uint       max;         // node count, power of 2.
+    uint       count;       // used node count.
+    func_node* node;
+} func_table;
+
+#define func_table_empty(t, i)   ((t)->node[(i)].hash == 0)
+#define func_table_key(t, i)     ((t)->node[(i)].key)
+#define func_table_val(t, i)     ((t)->node[(i)].val)
+
+extern func_table* func_table_alloc(uint max);
+extern void func_table_free(func_table *ft);
+extern void* func_table_get(func_table *ft, const char *key);
+extern func_node* func_table_node(func_table *ft, const char *key);
+extern int func_table_set(func_table *ft, const char *key, void *val);
+extern void func_table_remove(func_table *ft, const char *key);
 
 typedef struct _string_reference {
     char*   ref;            // point to string start byte.
@@ -67,37 +102,266 @@ typedef struct _string_reference {
 
 typedef struct _vohttpd vohttpd;
 
+enum FILE_CACHE_TYPE {
+    FILE_CACHE_NONE,        // the file does not exist.
+    FILE_CACHE_FILE,
+    FILE_CACHE_FOLDER,
+};
+
+enum FILE_ENCODING {
+    FILE_ENCODING_NONE = 0x00,
+    FILE_ENCODING_GZIP = 0x01,  // precompressed path.gz
+    FILE_ENCODING_BR   = 0x02,  // precompressed path.br
+};
+
+/* open file cache, keyed by resolved path. */
+typedef struct _file_cache {
+    uint        hash;       // hash of path.
+    uint        type;       // FILE_CACHE_TYPE.
+    uint        encoding;   // FILE_ENCODING, path is the precompressed file.
+    int         fd;         // opened file, -1 for folder or missing file.
+    uint        checked;    // last time(seconds) we stat the file.
+
+    long long   size;
+    long long   mtime;
+    unsigned long long inode;
+    const char* mime;       // mime type by file extension.
+    const char* cache;      // Cache-Control by file extension.
+    char        etag[MESSAGE_SIZE / 4];     // "inode-size-mtime"
+    char        modified[DATETIME_SIZE];    // Last-Modified
+
+    // small file is kept in memory, static response head + file body.
+    char*       data;
+    uint        head;       // size of head in data, body follows it.
+    uint        ref;        // CLOCK reference bit.
+
+    char        path[MESSAGE_SIZE];
+} file_cache;
+
+typedef struct _file_table {
+    uint        max;        // node count, FILE_CACHE_WAYS nodes per set.
+    uint        limit;      // max memory for file data.
+    uint        bytes;      // used memory for file data.
+    uint        hand;       // CLOCK hand.
+    file_cache  node[1];
+} file_table;
+
+extern file_table* file_table_alloc(uint max, uint limit);
+extern int file_cache_hot(vohttpd *set, file_cache *f);
+extern int file_cache_head(file_cache *f, int code, char *buf, int size);
+extern void file_table_free(file_table *ft);
+extern file_cache* file_cache_get(vohttpd *set, const char *path);
+extern file_cache* file_cache_encoded(vohttpd *set, const char *path, uint accept);
+
+/* intrusive timer, lives inside the object it times. */
+typedef struct _timer_node {
+    struct _timer_node* next;   // NULL if not scheduled.
+    struct _timer_node* prev;
+    uint   expire;              // monotonic seconds.
+} timer_node;
+
+typedef struct _timer_wheel {
+    uint        now;            // last tick processed.
+    timer_node  slot[TIMER_LEVELS][TIMER_SLOTS];
+} timer_wheel;
+
+extern timer_wheel* timer_wheel_alloc(uint now);
+extern void timer_wheel_free(timer_wheel *tw);
+extern void timer_add(timer_wheel *tw, timer_node *n, uint expire);
+extern void timer_del(timer_node *n);
+extern void timer_expire(timer_wheel *tw, uint now, void (*func)(timer_node *));
+
+/* job for the thread pool, embedded in the data of the job. */
+typedef struct _thread_job {
+    struct _thread_job* next;           // finished list link.
+    void  (*run)(struct _thread_job *); // called on a pool thread.
+} thread_job;
+
+typedef struct _thread_pool thread_pool;
+
+extern thread_pool* thread_pool_alloc(uint threads, uint size);
+extern void thread_pool_free(thread_pool *tp);
+extern int thread_pool_fd(thread_pool *tp);
+extern int thread_pool_submit(thread_pool *tp, thread_job *job);
+extern thread_job* thread_pool_done(thread_pool *tp);
+
+enum HTTP_METHOD {
+    HTTP_METHOD_UNKNOWN,
+    HTTP_METHOD_GET,
+    HTTP_METHOD_HEAD,
+    HTTP_METHOD_POST,
+    HTTP_METHOD_PUT,
+    HTTP_METHOD_DELETE,
+    HTTP_METHOD_OPTIONS,
+};
+
+/* common headers are found by id without comparing names. */
+enum HTTP_HEADER_ID {
+    HEADER_OTHER,
+    HEADER_HOST,
+    HEADER_CONNECTION,
+    HEADER_CONTENT_LENGTH,
+    HEADER_CONTENT_TYPE,
+    HEADER_ACCEPT_ENCODING,
+    HEADER_RANGE,
+    HEADER_IF_RANGE,
+    HEADER_IF_NONE_MATCH,
+    HEADER_IF_MODIFIED_SINCE,
+    HEADER_ID_COUNT,
+};
+
+typedef struct _http_header {
+    uint    id;                 // HTTP_HEADER_ID.
+    uint    hash;               // case insensitive hash of name.
+    string_reference name;
+    string_reference value;     // leading and trailing spaces removed.
+} http_header;
+
+/* request head parsed in one pass, every string points into the head buffer. */
+typedef struct _http_request {
+    uint    method;             // HTTP_METHOD.
+    uint    version;            // 10: HTTP/1.0, 11: HTTP/1.1.
+    string_reference uri;       // request target, /cgi-bin/test?a,b
+    string_reference path;      // target before '?'.
+    string_reference query;     // target after '?', empty if none.
+    uint    count;              // header count.
+    uchar   index[HEADER_ID_COUNT];  // header position + 1 by id, 0: missing.
+    http_header header[HEADER_COUNT];
+} http_request;
+
+/* request arena chunk, memory is bumped from data and all chunks are
+ * given back together when the request is done.
+ */
+typedef struct _arena_chunk {
+    struct _arena_chunk* next;
+    uint    size;               // size of data.
+    uint    used;
+    char    data[1];
+} arena_chunk;
+
+/* response data the socket did not take at once, sent when it is writable. */
+typedef struct _send_chunk {
+    struct _send_chunk* next;
+    int         fd;             // file range if >= 0(own descriptor), memory if < 0.
+    uint        size;           // memory: size of data.
+    uint        used;           // memory: filled size of data.
+    long long   offset;         // file: next offset to send. memory: sent size.
+    long long   left;           // file: size not sent.
+    char        data[1];
+} send_chunk;
+
+/* what the connection is waiting for, every state has its own deadline. */
+enum SOCKET_WAIT_TYPE {
+    SOCKET_WAIT_HEAD,       // request head, fixed deadline from its first byte.
+    SOCKET_WAIT_BODY,       // request body, extended while data comes.
+    SOCKET_WAIT_IDLE,       // keep-alive, waiting for next request.
+    SOCKET_WAIT_SEND,       // response, extended while the client reads.
+    SOCKET_WAIT_ASYNC,      // suspended plugin function, see vohttpd_suspend.
+};
+
 enum SOCKET_DATA_TYPE {
     SOCKET_DATA_NULL,
     SOCKET_DATA_STACK,
-    SOCKET_DATA_MMAP,
+    SOCKET_DATA_MMAP,       // body too big for head buffer, anonymous memory.
+    SOCKET_DATA_STREAM,     // body goes to plugin stream, not buffered.
 };
 
 typedef struct _socket_data {
     int   sock;
 
-    // this static buffer is used to store http header.
-    // if post header + body size < RECVBUF_SIZE, all store here.
+    // pooled buffer to store http header, only taken when data arrives.
+    // if post header + body size < buffer size, all store here.
     uint   used;        // received header size.
-    char   head[RECVBUF_SIZE];
+    uint   scan;        // head end is not in head[0, scan).
+    uint   limit;       // buffer size, 0 if no buffer.
+    char*  head;
 
     // if in post mode the receive buffer exceed our head buffer size,
     // we alloc a buffer for the body.
     uint   size;        // max size of the body buffer.
     uint   recv;        // received body data size.
+    uint   spill;       // mapped size of body, SOCKET_DATA_MMAP.
     char*  body;        // point to head + used if head buffer is enough.
     uint   type;        //
+    http_request* req;  // parsed head of current request, NULL until the
+                        // head is complete.
+    arena_chunk* arena; // memory of current request, see vohttpd_alloc.
+    const struct _plugin_stream* stream;    // receiving body, SOCKET_DATA_STREAM.
+    void*  user;        // plugin data of current request, cleared by reset.
+
+    uint   keep;        // keep the connection after current request.
+    uint   count;       // requests served on this connection.
+    uint   wait;        // SOCKET_WAIT_TYPE.
+    timer_node timer;   // deadline of current wait.
+
+    // sockets never block, response the client does not take is queued,
+    // next request is not read until it is sent.
+    send_chunk* out;    // queued response.
+    send_chunk* last;   // tail of out.
+    uint   queued;      // memory size of out.
+    uint   close;       // close the connection once out is sent.
+    long long sent;     // bytes out has given to the kernel.
+    long long taken;    // bytes the client had read when the send wait began.
+    uint   busy;        // blocking function runs on a pool thread, the loop
+                        // leaves the connection alone until it returns.
+    uint   sending;     // the event backend is sending out, see event_ops.
+
+    // data the event backend has received but the request has not read yet,
+    // only when the backend receives by itself(uring).
+    char*  in;
+    uint   in_size;
+    char*  in_heap;     // in is copied here when it outlives the loop round.
+    int    in_end;      // 1 the client closed, < 0 -errno after in.
+
+    // suspended plugin function, called again by the loop.
+    int  (*async)(struct _socket_data *, uint);
+    int    async_fd;    // fd it waits for, -1 if none.
 
     vohttpd* set;       // pointer to global setting.
+    struct _socket_data* next;  // free list link.
 } socket_data;
 
+/* connections indexed by socket, fds are small dense integers. */
+typedef struct _socket_table {
+    uint            max;        // slots in node, grows to cover the largest fd.
+    uint            count;      // connections alive.
+    uint            spare;      // connections in free list.
+    socket_data*    free;       // released connections for reuse.
+    socket_data*    closed;     // closed in this loop round, events may still
+                                // point to them, released at round end.
+    socket_data**   node;
+} socket_table;
+
+enum PLUGIN_FLAG {
+    PLUGIN_STREAM   = 0x01, // exported symbol is plugin_stream, not _plugin_func.
+    PLUGIN_BLOCKING = 0x02, // function may block(disk, heavy work), it runs on
+                            // the thread pool, its sends are queued and the
+                            // loop writes them when it returns.
+};
+
 typedef struct _plugin_info {
     const char*     name;       // plugin function name, max 31 bytes.
     const char*     note;       // plugin function note/readme, max 2047 bytes.
+    uint            flags;      // PLUGIN_FLAG, 0 for common function.
 } plugin_info;
 
 // exported functions interface must in this format.
 typedef int   (*_plugin_func)(socket_data *, string_reference *pa);
+
+/* POST body is given to the plugin chunk by chunk while it comes, instead
+ * of being buffered before the call. begin gets the uri parameters, data
+ * every received chunk, end sends the response. begin/data return < 0 to
+ * drop the connection(reply first if needed). abort(optional) is called if
+ * the connection is closed before end. per request state can be kept in
+ * d->user, allocated by vohttpd_alloc.
+ * request without body calls begin and end only.
+ */
+typedef struct _plugin_stream {
+    int   (*begin)(socket_data *, string_reference *pa);
+    int   (*data)(socket_data *, const char *, uint);
+    int   (*end)(socket_data *);
+    void  (*abort)(socket_data *);
+} plugin_stream;
 // query exported functions in the plugin, plugin must have this interface.
 typedef int   (*_plugin_query)(int, plugin_info *);
 // clean up when the plugin is about to unload, not necessary.
@@ -114,17 +378,102 @@ typedef int   (*_http_folder)(socket_data *, const char *);
 
 typedef const char* (*_load_plugin)(const char *);
 typedef const char* (*_unload_plugin)(const char *);
+// send never blocks, data the socket can not take now is queued.
+// return the size, or < 0 if the socket is broken or the queue is full.
 typedef int   (*_httpd_send)(int, const void*, int, int);
+typedef int   (*_httpd_sendv)(int, const struct iovec*, int, int);
+// memory released when current request is done, NULL if out of memory.
+typedef void* (*_httpd_alloc)(socket_data *, uint);
+
+/* async plugin function, instead of replying a function can suspend the
+ * request on an fd(backend socket, pipe...) and/or a deadline and return,
+ * the loop is free meanwhile. func is called on the loop with the events
+ * ready, 0 on timeout, or EVENT_CLOSED if the client is gone(clean up, do
+ * not reply). func replies, or suspends again. one wait at a time.
+ * a blocking function on a pool thread can only use fd -1 and secs 0, func
+ * is called with 0 on the loop once it returns, to finish the work which
+ * must not run on a thread(load plugin...).
+ */
+typedef int   (*_async_func)(socket_data *, uint event);
+// fd: < 0 for deadline only. secs: 0 for no deadline(fd >= 0) or next tick.
+typedef int   (*_httpd_suspend)(socket_data *, int fd, uint events, uint secs, _async_func func);
+
+enum EVENT_TYPE {
+    EVENT_READ   = 0x01,
+    EVENT_WRITE  = 0x02,
+    EVENT_SHARED = 0x04,    // listen socket, wake only one waiting loop.
+    EVENT_CLOSED = 0x08,    // async wait, the client has gone.
+    EVENT_DATA   = 0x10,    // recv done by the backend, res bytes in data.
+    EVENT_ACCEPT = 0x20,    // accept done by the backend, res is the client.
+    EVENT_SENT   = 0x40,    // send done by the backend, res bytes of out or -errno.
+};
+
+typedef struct _vohttpd_event {
+    uint   events;      // EVENT_READ/EVENT_WRITE.
+    void*  ptr;         // the pointer set when the socket was added.
+    int    res;         // EVENT_DATA: size, 0 closed or -errno. EVENT_ACCEPT: fd.
+                        // EVENT_SENT: bytes, 0 none or -errno.
+    char*  data;        // EVENT_DATA, valid until next wait.
+} vohttpd_event;
+
+/* event backend interface, select, epoll(linux default) and uring.
+ * accept, recv and send are optional, a backend that does the io itself(uring)
+ * reports EVENT_ACCEPT, EVENT_DATA and EVENT_SENT instead of readiness.
+ * send takes the queue from its head until EVENT_SENT, a memory chunk at the
+ * head is freed by the backend if the socket is removed before that.
+ */
+typedef struct _event_ops {
+    const char* name;
+    void* (*create)();
+    void  (*destroy)(void *poll);
+    int   (*add)(void *poll, int sock, uint events, void *ptr);
+    int   (*mod)(void *poll, int sock, uint events, void *ptr);
+    int   (*del)(void *poll, int sock);
+    int   (*wait)(void *poll, vohttpd_event *ev, int count, int timeout);
+    int   (*accept)(void *poll, int sock, void *ptr);   // keeps accepting.
+    int   (*recv)(void *poll, int sock, void *ptr);     // one recv, no poll.
+    int   (*send)(void *poll, int sock, void *ptr, send_chunk *c);
+} event_ops;
+
+extern const event_ops* event_ops_find(const char *name);
 
 struct _vohttpd {
     unsigned short port;            // default http server port.
     const char*    base;            // default http folder path.
 
-    linear_hash*   socks;           // store all accepted sockets.
-    string_hash*   funcs;           // store all registered plugins(file, function).
+    int            workers;         // worker process count, 0: single process.
+    int            worker;          // current worker index, -1 in master.
+    int            affinity;        // pin worker to cpu(worker % cpu count).
+
+    uint           keepalive;       // keep-alive idle timeout(seconds), 0: disabled.
+    uint           requests;        // max requests for one connection.
+    uint           send_rate;       // min bytes/s a client must read queued
+                                    // response, 0: any progress.
+    uint           body_limit;      // max buffered body of one request(bytes).
+    unsigned long long spill_limit; // max memory of all buffered bodies(bytes).
+    unsigned long long spilled;     // memory of buffered bodies now.
+    uint           now;             // loop time(monotonic seconds).
+    long long      date_time;       // wall clock seconds of date.
+    char           date[2][DATETIME_SIZE]; // Date header value, the loop formats
+                                    // the other one and then switches date_index,
+                                    // pool threads read it while it changes.
+    uint           date_index;
+
+    socket_table*  socks;           // store all accepted sockets.
+    func_table*    funcs;           // store all registered plugins(file, function).
+    file_table*    files;           // opened static files.
+    timer_wheel*   timers;          // connection deadlines.
+    thread_pool*   pool;            // runs blocking plugin functions.
+    uint           threads;         // pool thread count, 0: run them inline.
+
+    const event_ops* event;         // event backend used by the loop.
+    void*          poll;            // event backend instance.
 
     // common function hook.
     _httpd_send    send;
+    _httpd_sendv   sendv;
+    _httpd_alloc   alloc;
+    _httpd_suspend suspend;
     _http_filter   http_filter;
     _http_file     http_file;
     _http_folder   http_folder;
@@ -134,15 +483,51 @@ struct _vohttpd {
     _unload_plugin unload_plugin;
 };
 
+/* response builder, head lines and body segments are collected and sent
+ * with one sendmsg, Content-Length, Date and Connection are added by send.
+ * body is copied to request arena, or referred(memory must live until send).
+ */
+typedef struct _http_response {
+    socket_data*  d;
+    int           code;
+    int           error;        // head or data buffer overflow.
+    uint          head;         // used size of head.
+    uint          used;         // used size of data block.
+    uint          count;        // body segment count, iov[0] is the head.
+    unsigned long long length;  // body size.
+    struct iovec  iov[SENDV_COUNT];
+    char          buf[MESSAGE_SIZE * 4];    // head lines.
+    char*         data;         // copied body, block from request arena.
+    uint          size;         // size of data block.
+} http_response;
+
 // helper functions:
 extern char* string_reference_dup(string_reference *str, char *buf);
 extern int vohttpd_reply_head(char *d, int code);
 extern int vohttpd_http_file(socket_data *d, const char *path);
 extern int vohttpd_uri_parameters(socket_data *d, string_reference *s);
+extern int vohttpd_parse_request(http_request *r, char *head, uint size);
+extern uint vohttpd_header_hash(const char *name, uint size);
+extern int vohttpd_header_id(socket_data *d, uint id, string_reference *v);
+extern int vohttpd_header(socket_data *d, const char *name, string_reference *v);
 extern int vohttpd_first_parameter(string_reference *s, string_reference *f);
 extern const char *vohttpd_code_message(int code);
 extern const char *vohttpd_mime_map(const char *ext);
+extern const char *vohttpd_file_extend(const char *path);
+extern const char *vohttpd_cache_control(const char *ext);
 extern const char *vohttpd_gmtime();
+extern int vohttpd_itoa(char *buf, unsigned long long v);
+extern int vohttpd_head_line(char *buf, const char *name, const char *value);
+extern int vohttpd_head_number(char *buf, const char *name, unsigned long long value);
+extern const char *vohttpd_connection(socket_data *d);
+extern void* vohttpd_alloc(socket_data *d, uint size);
+extern int vohttpd_suspend(socket_data *d, int fd, uint events, uint secs, _async_func func);
+extern void vohttpd_response_init(http_response *r, socket_data *d, int code);
+extern int vohttpd_response_header(http_response *r, const char *name, const char *value);
+extern int vohttpd_response_write(http_response *r, const void *data, uint size);
+extern int vohttpd_response_printf(http_response *r, const char *format, ...);
+extern int vohttpd_response_ref(http_response *r, const void *data, uint size);
+extern int vohttpd_response_send(http_response *r);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,312 @@
+/* vohttpdcache: open file and stat cache for static file requests.
+ *
+ * author: Qin Wei(me@vonger.cn)
+ * compile: cc -c vohttpdcache.c -o vohttpdcache.o
+ *
+ * entries are keyed by resolved path and keep the file open, a hit within
+ * FILE_CACHE_TTL seconds does not touch the file system at all.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "vohttpd.h"
+
+file_table* file_table_alloc(uint max, uint limit)
+{
+    file_table *ft;
+    uint i;
+
+    // keep whole sets, a path only lives in the set its hash points to.
+    max = (max + FILE_CACHE_WAYS - 1) / FILE_CACHE_WAYS * FILE_CACHE_WAYS;
+    ft = (file_table *)malloc(sizeof(file_table) + max * sizeof(file_cache));
+    if(ft == NULL)
+        return NULL;
+
+    memset(ft, 0, sizeof(file_table) + max * sizeof(file_cache));
+    ft->max = max;
+    ft->limit = limit;
+    for(i = 0; i < max; i++)
+        ft->node[i].fd = -1;
+    return ft;
+}
+
+static void file_cache_drop(file_table *ft, file_cache *f)
+{
+    if(f->data == NULL)
+        return;
+    ft->bytes -= f->head + (uint)f->size;
+    free(f->data);
+    f->data = NULL;
+    f->ref = 0;
+}
+
+static void file_cache_close(file_table *ft, file_cache *f)
+{
+    file_cache_drop(ft, f);
+    if(f->fd >= 0)
+        close(f->fd);
+    f->fd = -1;
+    f->type = FILE_CACHE_NONE;
+    f->path[0] = '\0';
+}
+
+void file_table_free(file_table *ft)
+{
+    uint i;
+    if(ft == NULL)
+        return;
+    for(i = 0; i < ft->max; i++)
+        file_cache_close(ft, &ft->node[i]);
+    free(ft);
+}
+
+static int file_cache_same(file_cache *f, struct stat *st)
+{
+    return f->inode == (unsigned long long)st->st_ino &&
+           f->size == (long long)st->st_size &&
+           f->mtime == (long long)st->st_mtime;
+}
+
+static void file_cache_fill(file_cache *f, int fd, struct stat *st)
+{
+    struct tm tm;
+
+    f->fd = fd;
+    f->size = (long long)st->st_size;
+    f->mtime = (long long)st->st_mtime;
+    f->inode = (unsigned long long)st->st_ino;
+    f->type = S_ISDIR(st->st_mode) ? FILE_CACHE_FOLDER : FILE_CACHE_FILE;
+
+    // validators, precompressed file has its own etag.
+    snprintf(f->etag, sizeof(f->etag), "\"%llx-%llx-%llx%s\"", f->inode,
+            f->size, f->mtime, f->encoding == FILE_ENCODING_BR ? "-br" :
+            f->encoding == FILE_ENCODING_GZIP ? "-gz" : "");
+    strftime(f->modified, DATETIME_SIZE, "%a, %d %b %Y %H:%M:%S GMT",
+            gmtime_r(&st->st_mtime, &tm));
+
+    // folder does not need the fd.
+    if(f->type == FILE_CACHE_FOLDER) {
+        close(f->fd);
+        f->fd = -1;
+    }
+}
+
+/* open the file and fill its information, missing file is cached too. */
+static void file_cache_load(file_cache *f)
+{
+    struct stat st;
+    int fd;
+
+    f->fd = -1;
+    f->type = FILE_CACHE_NONE;
+
+    fd = open(f->path, O_RDONLY | O_CLOEXEC);
+    if(fd < 0)
+        return;
+    if(fstat(fd, &st) < 0 || !(S_ISREG(st.st_mode) || S_ISDIR(st.st_mode))) {
+        close(fd);
+        return;
+    }
+    file_cache_fill(f, fd, &st);
+}
+
+/* stat the path again, reopen if the file has been changed. */
+static void file_cache_check(file_table *ft, file_cache *f)
+{
+    struct stat st;
+
+    if(stat(f->path, &st) < 0) {
+        file_cache_drop(ft, f);
+        if(f->fd >= 0)
+            close(f->fd);
+        f->fd = -1;
+        f->type = FILE_CACHE_NONE;
+        return;
+    }
+    if(f->type != FILE_CACHE_NONE && file_cache_same(f, &st))
+        return;
+
+    file_cache_drop(ft, f);
+    if(f->fd >= 0)
+        close(f->fd);
+    file_cache_load(f);
+}
+
+static file_cache* file_cache_find(vohttpd *set, const char *path, uint encoding, const char *ext)
+{
+    file_table *ft = set->files;
+    file_cache *f, *old;
+    uint hash, i;
+
+    hash = string_hash_from(path) ^ encoding;
+    f = &ft->node[hash % (ft->max / FILE_CACHE_WAYS) * FILE_CACHE_WAYS];
+    old = NULL;
+
+    for(i = 0; i < FILE_CACHE_WAYS; i++, f++) {
+        if(f->hash == hash && f->encoding == encoding && f->path[0] &&
+           strcmp(f->path, path) == 0) {
+            if(set->now - f->checked >= FILE_CACHE_TTL) {
+                file_cache_check(ft, f);
+                f->checked = set->now;
+            }
+            return f;
+        }
+        if(old == NULL || (old->path[0] &&
+           (f->path[0] == '\0' || f->checked < old->checked)))
+            old = f;
+    }
+
+    // miss, replace the empty or least recently checked entry of the set.
+    f = old;
+    file_cache_close(ft, f);
+    f->hash = hash;
+    f->encoding = encoding;
+    f->mime = vohttpd_mime_map(ext);
+    f->cache = vohttpd_cache_control(ext);
+    strncpy(f->path, path, MESSAGE_SIZE - 1);
+    f->path[MESSAGE_SIZE - 1] = '\0';
+    f->checked = set->now;
+    file_cache_load(f);
+    return f;
+}
+
+/* get file information by path, never returns NULL.
+ * check type, FILE_CACHE_NONE means the file does not exist.
+ */
+file_cache* file_cache_get(vohttpd *set, const char *path)
+{
+    return file_cache_find(set, path, FILE_ENCODING_NONE, vohttpd_file_extend(path));
+}
+
+static int file_cache_compressible(const char *mime)
+{
+    return strncmp(mime, "text/", 5) == 0 || strstr(mime, "javascript") ||
+           strstr(mime, "json") || strstr(mime, "xml");
+}
+
+/* get the precompressed file(path.br, path.gz) if the client accepts it and
+ * it is not older than the file itself, or the file if there is none.
+ */
+file_cache* file_cache_encoded(vohttpd *set, const char *path, uint accept)
+{
+    static const struct {
+        uint        encoding;
+        const char* ext;
+    } sidecar[] = {
+        { FILE_ENCODING_BR, ".br" },
+        { FILE_ENCODING_GZIP, ".gz" },
+    };
+    char name[MESSAGE_SIZE];
+    long long mtime;
+    file_cache *f;
+    uint i;
+
+    f = file_cache_get(set, path);
+    if(f->type != FILE_CACHE_FILE || accept == 0 || !file_cache_compressible(f->mime))
+        return f;
+    mtime = f->mtime;
+
+    for(i = 0; i < sizeof(sidecar) / sizeof(sidecar[0]); i++) {
+        if(!(accept & sidecar[i].encoding))
+            continue;
+        if(snprintf(name, MESSAGE_SIZE, "%s%s", path, sidecar[i].ext) >= MESSAGE_SIZE)
+            continue;
+        f = file_cache_find(set, name, sidecar[i].encoding, vohttpd_file_extend(path));
+        if(f->type == FILE_CACHE_FILE && f->mtime >= mtime)
+            return f;
+    }
+
+    // the file entry might be replaced by sidecar in the same set.
+    return file_cache_get(set, path);
+}
+
+/* response head part which does not change until the file changes.
+ * code: 200 for full response, 304 for not modified(validators only),
+ *  206 for partial content, caller adds length, type and range.
+ */
+int file_cache_head(file_cache *f, int code, char *buf, int size)
+{
+    int n;
+
+    // every value is bounded by file_cache fields, far below SENDBUF_SIZE.
+    (void)size;
+    n = vohttpd_reply_head(buf, code);
+    if(code == 200) {
+        n += vohttpd_head_number(buf + n, HTTP_CONTENT_LENGTH, f->size);
+        n += vohttpd_head_line(buf + n, HTTP_CONTENT_TYPE, f->mime);
+    }
+    if(code != 304) {
+        if(f->encoding != FILE_ENCODING_NONE)
+            n += vohttpd_head_line(buf + n, HTTP_CONTENT_ENCODING,
+                    f->encoding == FILE_ENCODING_BR ? "br" : "gzip");
+        n += vohttpd_head_line(buf + n, HTTP_ACCEPT_RANGES, "bytes");
+    }
+    n += vohttpd_head_line(buf + n, HTTP_ETAG, f->etag);
+    n += vohttpd_head_line(buf + n, HTTP_LAST_MODIFIED, f->modified);
+    n += vohttpd_head_line(buf + n, HTTP_CACHE_CONTROL, f->cache);
+    if(file_cache_compressible(f->mime))
+        n += vohttpd_head_line(buf + n, "Vary", HTTP_ACCEPT_ENCODING);
+    return n;
+}
+
+/* load small file to memory together with its response head.
+ * return 0 if f->data is ready to send.
+ */
+int file_cache_hot(vohttpd *set, file_cache *f)
+{
+    file_table *ft = set->files;
+    char head[SENDBUF_SIZE];
+    uint size, need;
+    ssize_t ret;
+    file_cache *c;
+
+    if(f->data) {
+        f->ref = 1;
+        return 0;
+    }
+    if(f->type != FILE_CACHE_FILE || f->size > HOT_FILE_SIZE)
+        return -1;
+
+    size = (uint)file_cache_head(f, 200, head, SENDBUF_SIZE);
+    need = size + (uint)f->size;
+    if(need > ft->limit)
+        return -1;
+
+    // CLOCK, give used data a second chance, drop the first unused one.
+    while(ft->bytes + need > ft->limit) {
+        c = &ft->node[ft->hand];
+        ft->hand = (ft->hand + 1) % ft->max;
+        if(c->data == NULL)
+            continue;
+        if(c->ref) {
+            c->ref = 0;
+            continue;
+        }
+        file_cache_drop(ft, c);
+    }
+
+    f->data = (char *)malloc(need);
+    if(f->data == NULL)
+        return -1;
+    memcpy(f->data, head, size);
+
+    for(f->head = 0; f->head < f->size; f->head += ret) {
+        ret = pread(f->fd, f->data + size + f->head, (size_t)f->size - f->head, f->head);
+        if(ret <= 0) {
+            free(f->data);
+            f->data = NULL;
+            return -1;
+        }
+    }
+
+    f->head = size;
+    f->ref = 1;
+    ft->bytes += need;
+    return 0;
+}
@@ -0,0 +1,977 @@
+/* vohttpdevent: event backends used by the vohttpd main loop.
+ *
+ * author: Qin Wei(me@vonger.cn)
+ * compile: cc -c vohttpdevent.c -o vohttpdevent.o
+ *
+ * every backend reports ready sockets together with the pointer given
+ * when the socket was added, so the loop never has to search for them.
+ */
+
+#define _GNU_SOURCE     // pipe2, splice flags
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/select.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <poll.h>
+#if defined(__NR_io_uring_setup) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define VOHTTPD_URING
+#endif
+#endif
+#endif
+
+#include "vohttpd.h"
+
+/* select backend, portable fallback, limited by FD_SETSIZE. */
+typedef struct _select_poll {
+    int     maxfd;
+    fd_set  fdr;
+    fd_set  fdw;
+    void*   ptr[FD_SETSIZE];
+} select_poll;
+
+static void* select_create()
+{
+    select_poll *sp = (select_poll *)malloc(sizeof(select_poll));
+    if(sp == NULL)
+        return NULL;
+
+    sp->maxfd = -1;
+    FD_ZERO(&sp->fdr);
+    FD_ZERO(&sp->fdw);
+    return sp;
+}
+
+static void select_destroy(void *poll)
+{
+    free(poll);
+}
+
+static int select_mod(void *poll, int sock, uint events, void *ptr)
+{
+    select_poll *sp = (select_poll *)poll;
+
+    if(sock < 0 || sock >= FD_SETSIZE)
+        return -1;
+
+    FD_CLR(sock, &sp->fdr);
+    FD_CLR(sock, &sp->fdw);
+    if(events & EVENT_READ)
+        FD_SET(sock, &sp->fdr);
+    if(events & EVENT_WRITE)
+        FD_SET(sock, &sp->fdw);
+    sp->ptr[sock] = ptr;
+    sp->maxfd = max(sp->maxfd, sock);
+    return 0;
+}
+
+static int select_del(void *poll, int sock)
+{
+    select_poll *sp = (select_poll *)poll;
+
+    if(sock < 0 || sock >= FD_SETSIZE)
+        return -1;
+
+    FD_CLR(sock, &sp->fdr);
+    FD_CLR(sock, &sp->fdw);
+    sp->ptr[sock] = NULL;
+    while(sp->maxfd >= 0 && !FD_ISSET(sp->maxfd, &sp->fdr)
+          && !FD_ISSET(sp->maxfd, &sp->fdw))
+        sp->maxfd--;
+    return 0;
+}
+
+static int select_wait(void *poll, vohttpd_event *ev, int count, int timeout)
+{
+    select_poll *sp = (select_poll *)poll;
+    struct timeval tmv;
+    fd_set fdr, fdw;
+    int ready, sock, n = 0;
+
+    fdr = sp->fdr;
+    fdw = sp->fdw;
+    tmv.tv_sec = timeout / 1000;
+    tmv.tv_usec = timeout % 1000 * 1000;
+
+    ready = select(sp->maxfd + 1, &fdr, &fdw, NULL, timeout < 0 ? NULL : &tmv);
+    if(ready <= 0)
+        return ready;
+
+    for(sock = 0; sock <= sp->maxfd && n < count && ready > 0; sock++) {
+        uint events = 0;
+        if(FD_ISSET(sock, &fdr))
+            events |= EVENT_READ;
+        if(FD_ISSET(sock, &fdw))
+            events |= EVENT_WRITE;
+        if(events == 0)
+            continue;
+
+        ready--;
+        ev[n].events = events;
+        ev[n].ptr = sp->ptr[sock];
+        n++;
+    }
+    return n;
+}
+
+#ifdef __linux__
+/* epoll backend, edge triggered, only ready sockets cost anything. */
+typedef struct _epoll_poll {
+    int     fd;
+    struct epoll_event ev[EVENT_COUNT];
+} epoll_poll;
+
+static void* epoll_create_poll()
+{
+    epoll_poll *ep = (epoll_poll *)malloc(sizeof(epoll_poll));
+    if(ep == NULL)
+        return NULL;
+
+    ep->fd = epoll_create1(EPOLL_CLOEXEC);
+    if(ep->fd < 0) {
+        free(ep);
+        return NULL;
+    }
+    return ep;
+}
+
+static void epoll_destroy(void *poll)
+{
+    epoll_poll *ep = (epoll_poll *)poll;
+    close(ep->fd);
+    free(ep);
+}
+
+static uint epoll_events(uint events)
+{
+    uint e = EPOLLET | EPOLLRDHUP;
+    if(events & EVENT_READ)
+        e |= EPOLLIN;
+    if(events & EVENT_WRITE)
+        e |= EPOLLOUT;
+#ifdef EPOLLEXCLUSIVE
+    // wake only one of the loops waiting on a shared listen socket.
+    if(events & EVENT_SHARED)
+        e = (e & ~EPOLLRDHUP) | EPOLLEXCLUSIVE;
+#endif
+    return e;
+}
+
+static int epoll_add(void *poll, int sock, uint events, void *ptr)
+{
+    epoll_poll *ep = (epoll_poll *)poll;
+    struct epoll_event e;
+
+    e.events = epoll_events(events);
+    e.data.ptr = ptr;
+    return epoll_ctl(ep->fd, EPOLL_CTL_ADD, sock, &e);
+}
+
+static int epoll_mod(void *poll, int sock, uint events, void *ptr)
+{
+    epoll_poll *ep = (epoll_poll *)poll;
+    struct epoll_event e;
+
+    e.events = epoll_events(events & ~EVENT_SHARED);
+    e.data.ptr = ptr;
+    return epoll_ctl(ep->fd, EPOLL_CTL_MOD, sock, &e);
+}
+
+static int epoll_del(void *poll, int sock)
+{
+    epoll_poll *ep = (epoll_poll *)poll;
+    struct epoll_event e;   // kernel before 2.6.9 requires non-NULL.
+    return epoll_ctl(ep->fd, EPOLL_CTL_DEL, sock, &e);
+}
+
+static int epoll_wait_poll(void *poll, vohttpd_event *ev, int count, int timeout)
+{
+    epoll_poll *ep = (epoll_poll *)poll;
+    int ready, i;
+
+    ready = epoll_wait(ep->fd, ep->ev, min(count, EVENT_COUNT), timeout);
+    for(i = 0; i < ready; i++) {
+        uint e = ep->ev[i].events;
+        ev[i].events = 0;
+        if(e & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+            ev[i].events |= EVENT_READ;
+        if(e & (EPOLLOUT | EPOLLHUP | EPOLLERR))
+            ev[i].events |= EVENT_WRITE;
+        ev[i].ptr = ep->ev[i].data.ptr;
+    }
+    return ready;
+}
+#endif
+
+#ifdef VOHTTPD_URING
+/* io_uring backend. the listen socket keeps one multishot accept, clients
+ * receive by single recv into buffers the kernel picks from a registered
+ * ring and send their queue by one linked chain at a time, everything else
+ * is multishot poll. requests are queued as sqes and go to the kernel
+ * together with the wait, one syscall per round.
+ * user_data is kind | tag << 32 | sock, tag is the poll or the added socket,
+ * completions of removed ones are dropped. send chains carry their state
+ * pointer instead. a live request keeps the closed socket open, so removal
+ * is retried until the kernel really drops it.
+ */
+#define URING_ENTRIES   1024
+#define URING_BUFS      256             // ring buffers, power of 2.
+#define URING_BUF_SIZE  16384
+#define URING_TAG       0x0fffffff
+#define URING_CANCEL    (1ULL << 60)    // completion of a remove.
+#define URING_RECV      (1ULL << 61)
+#define URING_ACCEPT    (2ULL << 61)
+#define URING_SEND      (3ULL << 61)
+#define URING_KIND      (3ULL << 61)
+#define URING_LINK_MAX  16384           // memory sent all or nothing before a file.
+#define URING_PIPE_SIZE 65536           // file bytes a chain moves, default pipe size.
+
+// send chain requests, low bits of the state pointer.
+enum URING_SEND_OP {
+    URING_OP_SEND,      // memory chunk.
+    URING_OP_FILL,      // file to pipe.
+    URING_OP_POLL,      // wait until the socket takes more.
+    URING_OP_OUT,       // pipe to socket.
+};
+#ifndef POLLRDHUP
+#define POLLRDHUP       0x2000  // same as EPOLLRDHUP, glibc hides it.
+#endif
+
+/* send state of a socket, it lives on after the socket is removed until
+ * the kernel is done with its chain.
+ */
+typedef struct _uring_chain {
+    struct _uring_chain* next;  // chains or orphans list.
+    send_chunk* chunk;  // head of the queue.
+    send_chunk* mem;    // memory chunk the chain reads.
+    void*   ptr;
+    int     sock;
+    int     file;       // own descriptor of the file the chain reads.
+    int     pipe[2];
+    uint    piped;      // bytes in the pipe, not in the socket yet.
+    uint    ops;        // requests of the chain in the kernel.
+    uint    live;       // 1 << URING_SEND_OP of them.
+    uint    pending;    // chain is built at next wait.
+    uint    orphan;     // socket is removed.
+    int     sent;
+    int     err;
+} uring_chain;
+
+typedef struct _uring_fd {
+    uring_chain* send;
+    void*   ptr;
+    uint    id;         // 0 if the socket is not added.
+    uint    gen;        // current poll, 0 if none.
+    uint    mask;       // poll mask.
+    uint    kind;       // URING_RECV/URING_ACCEPT >> 61, 0 for poll only.
+    uint    busy;       // recv or accept is in the kernel.
+} uring_fd;
+
+typedef struct _uring_poll {
+    int     fd;
+    uint    pending;    // sqes not submitted yet.
+    uint    tail;       // local sq tail.
+
+    uint*   sq_head;
+    uint*   sq_tail;
+    uint    sq_mask;
+    uint    cq_mask;
+    uint*   cq_head;
+    uint*   cq_tail;
+    struct io_uring_sqe* sqes;
+    struct io_uring_cqe* cqes;
+
+    void*   ring;
+    size_t  ring_size;
+    size_t  sqes_size;
+
+    // recv buffers, the ones given to the loop return on next wait.
+    struct io_uring_buf_ring* br;
+    char*   bufs;
+    unsigned short br_tail;
+    uint    held;
+    unsigned short hold[EVENT_COUNT];
+
+    uring_chain* chains;     // chains to build.
+    uring_chain* orphans;    // chains of removed sockets.
+
+    uint    gen;
+    uint    max;
+    uring_fd* node;
+} uring_poll;
+
+static int uring_enter(int fd, uint submit, uint wait, uint flags, void *arg, size_t size)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, submit, wait, flags, arg, size);
+}
+
+static void uring_send_free(uring_chain *s)
+{
+    if(s->file >= 0)
+        close(s->file);
+    if(s->pipe[0] >= 0) {
+        close(s->pipe[0]);
+        close(s->pipe[1]);
+    }
+    free(s);
+}
+
+static void uring_destroy(void *poll)
+{
+    uring_poll *up = (uring_poll *)poll;
+    uring_chain *s;
+    uint i;
+
+    for(i = 0; i < up->max; i++) {
+        if(up->node[i].send)
+            uring_send_free(up->node[i].send);
+    }
+    while((s = up->orphans) != NULL) {
+        up->orphans = s->next;
+        free(s->mem);
+        uring_send_free(s);
+    }
+    if(up->sqes)
+        munmap(up->sqes, up->sqes_size);
+    if(up->ring)
+        munmap(up->ring, up->ring_size);
+    if(up->fd >= 0)
+        close(up->fd);
+    if(up->br)
+        munmap(up->br, URING_BUFS * sizeof(struct io_uring_buf));
+    if(up->bufs)
+        munmap(up->bufs, URING_BUFS * URING_BUF_SIZE);
+    free(up->node);
+    free(up);
+}
+
+static void uring_buf_put(uring_poll *up, uint bid)
+{
+    struct io_uring_buf *b = &up->br->bufs[up->br_tail & (URING_BUFS - 1)];
+
+    b->addr = (unsigned long long)(uintptr_t)(up->bufs + bid * URING_BUF_SIZE);
+    b->len = URING_BUF_SIZE;
+    b->bid = (unsigned short)bid;
+    up->br_tail++;
+}
+
+/* return NULL if the kernel has no io_uring or it is too old(before 5.19),
+ * multishot poll and accept, buffer ring and timeout in io_uring_enter
+ * are required.
+ */
+static void* uring_create()
+{
+    uint need = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP |
+                IORING_FEAT_EXT_ARG | IORING_FEAT_RSRC_TAGS;
+    struct io_uring_params p;
+    struct io_uring_buf_reg reg;
+    uring_poll *up;
+    char *ring;
+    uint i;
+
+    up = (uring_poll *)calloc(1, sizeof(uring_poll));
+    if(up == NULL)
+        return NULL;
+    memset(&p, 0, sizeof(p));
+    up->fd = (int)syscall(__NR_io_uring_setup, URING_ENTRIES, &p);
+    if(up->fd < 0 || (p.features & need) != need) {
+        uring_destroy(up);
+        return NULL;
+    }
+
+    // sq and cq rings share one mapping.
+    up->ring_size = max(p.sq_off.array + p.sq_entries * sizeof(uint),
+                        p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe));
+    up->ring = mmap(NULL, up->ring_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, up->fd, IORING_OFF_SQ_RING);
+    if(up->ring == MAP_FAILED) {
+        up->ring = NULL;
+        uring_destroy(up);
+        return NULL;
+    }
+    up->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    up->sqes = (struct io_uring_sqe *)mmap(NULL, up->sqes_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, up->fd, IORING_OFF_SQES);
+    if(up->sqes == MAP_FAILED) {
+        up->sqes = NULL;
+        uring_destroy(up);
+        return NULL;
+    }
+
+    ring = (char *)up->ring;
+    up->sq_head = (uint *)(ring + p.sq_off.head);
+    up->sq_tail = (uint *)(ring + p.sq_off.tail);
+    up->sq_mask = *(uint *)(ring + p.sq_off.ring_mask);
+    up->cq_head = (uint *)(ring + p.cq_off.head);
+    up->cq_tail = (uint *)(ring + p.cq_off.tail);
+    up->cq_mask = *(uint *)(ring + p.cq_off.ring_mask);
+    up->cqes = (struct io_uring_cqe *)(ring + p.cq_off.cqes);
+    // sqe index always equals sq slot.
+    for(i = 0; i < p.sq_entries; i++)
+        ((uint *)(ring + p.sq_off.array))[i] = i;
+    up->tail = *up->sq_tail;
+
+    // buffer ring is page aligned memory shared with the kernel.
+    up->br = (struct io_uring_buf_ring *)mmap(NULL, URING_BUFS * sizeof(struct io_uring_buf),
+                    PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    up->bufs = (char *)mmap(NULL, URING_BUFS * URING_BUF_SIZE,
+                    PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(up->br == MAP_FAILED || up->bufs == MAP_FAILED) {
+        if(up->br == MAP_FAILED)
+            up->br = NULL;
+        if(up->bufs == MAP_FAILED)
+            up->bufs = NULL;
+        uring_destroy(up);
+        return NULL;
+    }
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (unsigned long long)(uintptr_t)up->br;
+    reg.ring_entries = URING_BUFS;
+    reg.bgid = 0;
+    if(syscall(__NR_io_uring_register, up->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        uring_destroy(up);
+        return NULL;
+    }
+    for(i = 0; i < URING_BUFS; i++)
+        uring_buf_put(up, i);
+    __atomic_store_n(&up->br->tail, up->br_tail, __ATOMIC_RELEASE);
+    return up;
+}
+
+static int uring_submit(uring_poll *up, uint wait, uint flags, void *arg, size_t size)
+{
+    uint submit = up->pending;
+
+    // kernel takes at most what is behind the tail, no need to retry.
+    __atomic_store_n(up->sq_tail, up->tail, __ATOMIC_RELEASE);
+    up->pending = 0;
+    return uring_enter(up->fd, submit, wait, flags, arg, size);
+}
+
+static struct io_uring_sqe* uring_sqe(uring_poll *up)
+{
+    struct io_uring_sqe *sqe;
+
+    // ring is full, hand the queued ones to the kernel first.
+    if(up->tail - __atomic_load_n(up->sq_head, __ATOMIC_ACQUIRE) > up->sq_mask)
+        uring_submit(up, 0, 0, NULL, 0);
+    sqe = &up->sqes[up->tail & up->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    up->tail++;
+    up->pending++;
+    return sqe;
+}
+
+static uint uring_tag(uring_poll *up)
+{
+    // 0 means none, skip it when it wraps.
+    up->gen = (up->gen + 1) & URING_TAG;
+    if(up->gen == 0)
+        up->gen = 1;
+    return up->gen;
+}
+
+static void uring_arm(uring_poll *up, int sock)
+{
+    struct io_uring_sqe *sqe = uring_sqe(up);
+
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = sock;
+    sqe->poll32_events = up->node[sock].mask;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->user_data = (unsigned long long)up->node[sock].gen << 32 | (uint)sock;
+}
+
+static void uring_arm_io(uring_poll *up, int sock)
+{
+    struct io_uring_sqe *sqe = uring_sqe(up);
+    unsigned long long kind = (unsigned long long)up->node[sock].kind << 61;
+
+    sqe->fd = sock;
+    if(kind == URING_ACCEPT) {
+        sqe->opcode = IORING_OP_ACCEPT;
+        sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+        sqe->accept_flags = SOCK_NONBLOCK;
+    } else {
+        // len 0 takes the whole buffer.
+        sqe->opcode = IORING_OP_RECV;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = 0;
+    }
+    sqe->user_data = kind | (unsigned long long)up->node[sock].id << 32 | (uint)sock;
+    up->node[sock].busy = 1;
+}
+
+static void uring_cancel(uring_poll *up, unsigned long long data)
+{
+    struct io_uring_sqe *sqe = uring_sqe(up);
+
+    sqe->opcode = (data & URING_KIND) ? IORING_OP_ASYNC_CANCEL : IORING_OP_POLL_REMOVE;
+    sqe->fd = -1;
+    sqe->addr = data;
+    sqe->user_data = data | URING_CANCEL;
+}
+
+static void uring_send_unlink(uring_chain **list, uring_chain *s)
+{
+    while(*list && *list != s)
+        list = &(*list)->next;
+    if(*list)
+        *list = s->next;
+}
+
+static struct io_uring_sqe* uring_send_sqe(uring_poll *up, uring_chain *s, uint op, uint link, int fd)
+{
+    struct io_uring_sqe *sqe = uring_sqe(up);
+
+    sqe->fd = fd;
+    sqe->flags = link ? IOSQE_IO_LINK : 0;
+    sqe->user_data = URING_SEND | (unsigned long long)(uintptr_t)s | op;
+    s->ops++;
+    s->live |= 1 << op;
+    return sqe;
+}
+
+/* the pipe, and the file unless the pipe still has some of it. */
+static int uring_send_file(uring_chain *s, send_chunk *f)
+{
+    if(s->pipe[0] < 0 && pipe2(s->pipe, O_NONBLOCK | O_CLOEXEC) < 0)
+        return -1;
+    if(s->piped == 0 && s->file < 0)
+        s->file = dup(f->fd);
+    return s->piped == 0 && s->file < 0 ? -1 : 0;
+}
+
+/* one chain for the head of the queue. memory is sent as it is, a file goes
+ * through the pipe once the socket can take it. a small memory chunk(the
+ * response head) is sent all or nothing, so the file behind it is linked.
+ */
+static void uring_send_build(uring_poll *up, uring_chain *s)
+{
+    send_chunk *c = s->chunk, *f = c;
+    struct io_uring_sqe *sqe;
+    uint len;
+
+    // a chain must not be split by a submit.
+    if(up->sq_mask + 1 - (up->tail - __atomic_load_n(up->sq_head, __ATOMIC_ACQUIRE)) < 4)
+        uring_submit(up, 0, 0, NULL, 0);
+
+    if(c->fd < 0) {
+        len = c->used - (uint)c->offset;
+        f = c->next && c->next->fd >= 0 && len <= URING_LINK_MAX ? c->next : NULL;
+        if(f && uring_send_file(s, f) < 0)
+            f = NULL;
+        sqe = uring_send_sqe(up, s, URING_OP_SEND, f != NULL, s->sock);
+        sqe->opcode = IORING_OP_SEND;
+        sqe->addr = (unsigned long long)(uintptr_t)(c->data + c->offset);
+        sqe->len = len;
+        sqe->msg_flags = MSG_NOSIGNAL | (f ? MSG_WAITALL : 0);
+        s->mem = c;
+        if(f == NULL)
+            return;
+    } else if(uring_send_file(s, f) < 0) {
+        // no descriptor left, report it by a nop.
+        s->err = -errno;
+        sqe = uring_send_sqe(up, s, URING_OP_POLL, 0, -1);
+        sqe->opcode = IORING_OP_NOP;
+        return;
+    }
+
+    len = s->piped;
+    if(len == 0) {
+        len = (uint)min(f->left, URING_PIPE_SIZE);
+        sqe = uring_send_sqe(up, s, URING_OP_FILL, 1, s->pipe[1]);
+        sqe->opcode = IORING_OP_SPLICE;
+        sqe->splice_fd_in = s->file;
+        sqe->splice_off_in = (unsigned long long)f->offset;
+        sqe->off = (unsigned long long)-1;
+        sqe->len = len;
+        sqe->splice_flags = SPLICE_F_MOVE | SPLICE_F_NONBLOCK;
+    }
+    // splice does not wait for a full socket, the poll does.
+    sqe = uring_send_sqe(up, s, URING_OP_POLL, 1, s->sock);
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->poll32_events = POLLOUT;
+    sqe = uring_send_sqe(up, s, URING_OP_OUT, 0, s->sock);
+    sqe->opcode = IORING_OP_SPLICE;
+    sqe->splice_fd_in = s->pipe[0];
+    sqe->splice_off_in = (unsigned long long)-1;
+    sqe->off = (unsigned long long)-1;
+    sqe->len = len;
+    sqe->splice_flags = SPLICE_F_MOVE | SPLICE_F_NONBLOCK;
+}
+
+/* a request of the chain is done, return 1 if ev is set(chain is done). */
+static int uring_send_done(uring_poll *up, uring_chain *s, uint op, int res, vohttpd_event *ev)
+{
+    s->ops--;
+    s->live &= ~(1 << op);
+    if(res == -ECANCELED) {
+        // link is broken by an earlier one, which tells why.
+    } else if(op == URING_OP_FILL) {
+        if(res > 0)
+            s->piped += res;
+        else
+            s->err = res < 0 ? res : -EIO;  // file is shorter than it was.
+    } else if(op == URING_OP_SEND || op == URING_OP_OUT) {
+        if(res > 0) {
+            s->sent += res;
+            if(op == URING_OP_OUT)
+                s->piped -= res;
+        } else if(res < 0 && res != -EAGAIN) {
+            s->err = res;
+        }
+    } else if(res < 0) {
+        s->err = res;
+    }
+    if(s->ops)
+        return 0;
+
+    if(s->file >= 0) {
+        close(s->file);
+        s->file = -1;
+    }
+    if(s->orphan) {
+        uring_send_unlink(&up->orphans, s);
+        free(s->mem);
+        uring_send_free(s);
+        return 0;
+    }
+    ev->events = EVENT_SENT;
+    ev->res = s->sent > 0 ? s->sent : s->err;
+    ev->data = NULL;
+    ev->ptr = s->ptr;
+    s->mem = NULL;      // the loop's again.
+    s->sent = 0;
+    s->err = 0;
+    return 1;
+}
+
+/* the socket is removed, its chain keeps the memory until the kernel is done. */
+static void uring_send_drop(uring_poll *up, uring_chain *s)
+{
+    uint op;
+
+    if(s->pending) {
+        uring_send_unlink(&up->chains, s);
+        if(s->chunk->fd < 0)
+            free(s->chunk);
+        uring_send_free(s);
+    } else if(s->ops) {
+        s->orphan = 1;
+        s->next = up->orphans;
+        up->orphans = s;
+        for(op = URING_OP_SEND; op <= URING_OP_OUT; op++) {
+            if(s->live & (1 << op))
+                uring_cancel(up, URING_SEND | (unsigned long long)(uintptr_t)s | op);
+        }
+    } else {
+        uring_send_free(s);
+    }
+}
+
+static int uring_send_orphan(uring_poll *up, unsigned long long data)
+{
+    uring_chain *s;
+    for(s = up->orphans; s; s = s->next) {
+        if((unsigned long long)(uintptr_t)s == (data & ~(URING_KIND | 3ULL)))
+            return 1;
+    }
+    return 0;
+}
+
+static uring_fd* uring_node(uring_poll *up, int sock, void *ptr)
+{
+    uring_fd *node;
+    uint n;
+
+    if(sock < 0)
+        return NULL;
+    if((uint)sock >= up->max) {
+        for(n = up->max ? up->max : 256; n <= (uint)sock; n <<= 1);
+        node = (uring_fd *)realloc(up->node, n * sizeof(uring_fd));
+        if(node == NULL)
+            return NULL;
+        memset(node + up->max, 0, (n - up->max) * sizeof(uring_fd));
+        up->node = node;
+        up->max = n;
+    }
+    node = &up->node[sock];
+    if(node->id == 0)
+        node->id = uring_tag(up);
+    node->ptr = ptr;
+    return node;
+}
+
+static int uring_mod(void *poll, int sock, uint events, void *ptr)
+{
+    uring_poll *up = (uring_poll *)poll;
+    uring_fd *node = uring_node(up, sock, ptr);
+
+    if(node == NULL)
+        return -1;
+    if(node->gen)
+        uring_cancel(up, (unsigned long long)node->gen << 32 | (uint)sock);
+    node->gen = 0;
+    // recv reports the data and the close, send the write.
+    if(node->kind)
+        events &= ~(EVENT_READ | EVENT_WRITE);
+    if(!(events & (EVENT_READ | EVENT_WRITE)))
+        return 0;
+    node->gen = uring_tag(up);
+    node->mask = POLLRDHUP;
+    if(events & EVENT_READ)
+        node->mask |= POLLIN;
+    if(events & EVENT_WRITE)
+        node->mask |= POLLOUT;
+    // every loop wakes on the shared listen socket, accept sorts it out.
+    if((events & EVENT_SHARED) || node->kind)
+        node->mask &= ~POLLRDHUP;
+    uring_arm(up, sock);
+    return 0;
+}
+
+static int uring_del(void *poll, int sock)
+{
+    uring_poll *up = (uring_poll *)poll;
+    uring_fd *node;
+
+    if(sock < 0 || (uint)sock >= up->max || up->node[sock].id == 0)
+        return -1;
+    node = &up->node[sock];
+    if(node->send)
+        uring_send_drop(up, node->send);
+    if(node->gen)
+        uring_cancel(up, (unsigned long long)node->gen << 32 | (uint)sock);
+    if(node->busy)
+        uring_cancel(up, (unsigned long long)node->kind << 61 |
+                     (unsigned long long)node->id << 32 | (uint)sock);
+    memset(node, 0, sizeof(uring_fd));
+    return 0;
+}
+
+static int uring_accept(void *poll, int sock, void *ptr)
+{
+    uring_poll *up = (uring_poll *)poll;
+    uring_fd *node = uring_node(up, sock, ptr);
+
+    if(node == NULL)
+        return -1;
+    node->kind = (uint)(URING_ACCEPT >> 61);
+    if(!node->busy)
+        uring_arm_io(up, sock);
+    return 0;
+}
+
+/* one recv at a time, next one after the loop has taken the data. */
+static int uring_recv(void *poll, int sock, void *ptr)
+{
+    uring_poll *up = (uring_poll *)poll;
+    uring_fd *node = uring_node(up, sock, ptr);
+
+    if(node == NULL)
+        return -1;
+    node->kind = (uint)(URING_RECV >> 61);
+    if(!node->busy)
+        uring_arm_io(up, sock);
+    return 0;
+}
+
+/* send the queue from c, the chain is built at next wait with all that is
+ * queued until then.
+ */
+static int uring_send(void *poll, int sock, void *ptr, send_chunk *c)
+{
+    uring_poll *up = (uring_poll *)poll;
+    uring_fd *node = uring_node(up, sock, ptr);
+    uring_chain *s;
+
+    if(node == NULL)
+        return -1;
+    s = node->send;
+    if(s == NULL) {
+        s = (uring_chain *)calloc(1, sizeof(uring_chain));
+        if(s == NULL)
+            return -1;
+        s->sock = sock;
+        s->file = -1;
+        s->pipe[0] = s->pipe[1] = -1;
+        node->send = s;
+    }
+    if(s->pending || s->ops)
+        return -1;
+    s->ptr = ptr;
+    s->chunk = c;
+    s->pending = 1;
+    s->next = up->chains;
+    up->chains = s;
+    return 0;
+}
+
+static int uring_wait(void *poll, vohttpd_event *ev, int count, int timeout)
+{
+    uring_poll *up = (uring_poll *)poll;
+    struct io_uring_getevents_arg arg;
+    struct __kernel_timespec ts;
+    struct io_uring_cqe *cqe;
+    unsigned long long kind;
+    uint head, tail, sock, e;
+    uring_chain *s;
+    uring_fd *node;
+    int n = 0;
+
+    // the loop is done with last round's data.
+    while(up->held)
+        uring_buf_put(up, up->hold[--up->held]);
+    __atomic_store_n(&up->br->tail, up->br_tail, __ATOMIC_RELEASE);
+
+    // chains asked for in this round, with all that was queued after.
+    while((s = up->chains) != NULL) {
+        up->chains = s->next;
+        s->pending = 0;
+        uring_send_build(up, s);
+    }
+
+    head = *up->cq_head;
+    tail = __atomic_load_n(up->cq_tail, __ATOMIC_ACQUIRE);
+    if(head == tail) {
+        memset(&arg, 0, sizeof(arg));
+        if(timeout >= 0) {
+            ts.tv_sec = timeout / 1000;
+            ts.tv_nsec = timeout % 1000 * 1000000LL;
+            arg.ts = (unsigned long long)(uintptr_t)&ts;
+        }
+        if(uring_submit(up, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+                        &arg, sizeof(arg)) < 0 && errno != ETIME && errno != EINTR)
+            return -1;
+        tail = __atomic_load_n(up->cq_tail, __ATOMIC_ACQUIRE);
+    } else if(up->pending) {
+        uring_submit(up, 0, 0, NULL, 0);
+    }
+
+    if(count > EVENT_COUNT)
+        count = EVENT_COUNT;
+    for(; head != tail && n < count; head++) {
+        cqe = &up->cqes[head & up->cq_mask];
+        sock = (uint)cqe->user_data;
+        kind = cqe->user_data & URING_KIND;
+        if(cqe->user_data & URING_CANCEL) {
+            // the request was running, try again unless its chain is gone.
+            if(cqe->res == -EALREADY && (kind != URING_SEND ||
+               uring_send_orphan(up, cqe->user_data)))
+                uring_cancel(up, cqe->user_data & ~URING_CANCEL);
+            continue;
+        }
+        if(kind == URING_SEND) {
+            s = (uring_chain *)(uintptr_t)(cqe->user_data & ~(URING_KIND | 3ULL));
+            n += uring_send_done(up, s, (uint)(cqe->user_data & 3), cqe->res, &ev[n]);
+            continue;
+        }
+        node = sock < up->max ? &up->node[sock] : NULL;
+        e = (uint)(cqe->user_data >> 32) & URING_TAG;
+        if(kind == URING_RECV) {
+            if(node == NULL || node->id != e || node->kind != (uint)(kind >> 61)) {
+                // removed already, the buffer goes back to the ring.
+                if(cqe->flags & IORING_CQE_F_BUFFER)
+                    uring_buf_put(up, cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+                continue;
+            }
+            node->busy = 0;
+            // ring is empty until the loop returns buffers, or interrupted.
+            if(cqe->res == -ENOBUFS || cqe->res == -EINTR || cqe->res == -EAGAIN) {
+                uring_arm_io(up, (int)sock);
+                continue;
+            }
+            ev[n].events = EVENT_READ | EVENT_DATA;
+            ev[n].res = cqe->res;
+            ev[n].data = NULL;
+            if(cqe->flags & IORING_CQE_F_BUFFER) {
+                e = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+                up->hold[up->held++] = (unsigned short)e;
+                ev[n].data = up->bufs + e * URING_BUF_SIZE;
+            }
+            ev[n].ptr = node->ptr;
+            n++;
+            continue;
+        }
+        if(kind == URING_ACCEPT) {
+            if(node == NULL || node->id != e || node->kind != (uint)(kind >> 61)) {
+                // nobody takes the client, and the accept must stop.
+                if(cqe->res >= 0)
+                    close(cqe->res);
+                if(cqe->flags & IORING_CQE_F_MORE)
+                    uring_cancel(up, cqe->user_data);
+                continue;
+            }
+            // multishot ended on error or cq overflow, arm it again.
+            if(!(cqe->flags & IORING_CQE_F_MORE))
+                uring_arm_io(up, (int)sock);
+            if(cqe->res < 0)
+                continue;
+            ev[n].events = EVENT_ACCEPT;
+            ev[n].res = cqe->res;
+            ev[n].ptr = node->ptr;
+            n++;
+            continue;
+        }
+        if(node == NULL || node->gen != e) {
+            // removed or replaced already, but still alive.
+            if(cqe->flags & IORING_CQE_F_MORE)
+                uring_cancel(up, cqe->user_data);
+            continue;
+        }
+        // multishot ended on cq overflow, arm it again. on error let the
+        // loop find it out by reading.
+        if(!(cqe->flags & IORING_CQE_F_MORE) && cqe->res >= 0)
+            uring_arm(up, (int)sock);
+        e = cqe->res < 0 ? POLLERR : (uint)cqe->res;
+        ev[n].events = 0;
+        if(e & (POLLIN | POLLRDHUP | POLLHUP | POLLERR))
+            ev[n].events |= EVENT_READ;
+        if(e & (POLLOUT | POLLHUP | POLLERR))
+            ev[n].events |= EVENT_WRITE;
+        ev[n].ptr = node->ptr;
+        n++;
+    }
+    __atomic_store_n(up->cq_head, head, __ATOMIC_RELEASE);
+    return n;
+}
+#endif
+
+static const event_ops event_backends[] = {
+#ifdef __linux__
+    { "epoll", epoll_create_poll, epoll_destroy, epoll_add, epoll_mod, epoll_del, epoll_wait_poll,
+      NULL, NULL, NULL },
+#endif
+#ifdef VOHTTPD_URING
+    { "uring", uring_create, uring_destroy, uring_mod, uring_mod, uring_del, uring_wait,
+      uring_accept, uring_recv, uring_send },
+#endif
+    // select has no separate add, mod sets the interest either way.
+    { "select", select_create, select_destroy, select_mod, select_mod, select_del, select_wait,
+      NULL, NULL, NULL },
+};
+
+/* find backend by name, NULL or empty name returns the default(first) one. */
+const event_ops* event_ops_find(const char *name)
+{
+    uint i;
+    if(name == NULL || *name == '\0')
+        return event_backends;
+
+    for(i = 0; i < sizeof(event_backends) / sizeof(event_ops); i++) {
+        if(strcmp(event_backends[i].name, name) == 0)
+            return &event_backends[i];
+    }
+    return NULL;
+}
@@ -7,197 +7,199 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <strings.h>
 #include <stdlib.h>
+#include <stdarg.h>
+#include <time.h>
 #include <sys/time.h>
 #include <sys/socket.h>
 
 #include "vohttpd.h"
 
-linear_hash* linear_hash_alloc(uint unit, uint max)
+uint string_hash_from(const char *str)
 {
-    linear_hash *lh =
-        (linear_hash *)malloc(max * unit + sizeof(linear_hash));
-    if(lh == NULL)
-        return NULL;
-
-    lh->unit = unit;
-    lh->max = max;
-
-    while(max--)
-        linear_hash_clear(lh, max);
-    return lh;
+    uint hash = *str;
+    while(*str++)
+        hash = hash * 31 + *str;
+    return hash;
 }
 
-uchar* linear_hash_get(linear_hash *lh, uint key)
+func_table* func_table_alloc(uint max)
 {
-    uint pos = key % lh->max, i;
-    // match node in the first hit.
-    if(linear_hash_key(lh, pos) == key)
-        return linear_hash_val(lh, pos);
+    func_table *ft;
+    uint n = 8;
 
-    // try to hit next node if we miss the first.
-    for(i = pos + 1; ; i++) {
-        if(i >= lh->max)
-            i = 0;
-        if(i == pos)
-            break;
-
-        if(linear_hash_key(lh, i) == key)
-            return linear_hash_val(lh, i);
+    while(n < max)
+        n *= 2;
+    ft = (func_table *)malloc(sizeof(func_table));
+    if(ft == NULL)
+        return NULL;
+    ft->node = (func_node *)calloc(n, sizeof(func_node));
+    if(ft->node == NULL) {
+        free(ft);
+        return NULL;
     }
-    return NULL;
+    ft->max = n;
+    ft->count = 0;
+    return ft;
 }
 
-uchar* linear_hash_set(linear_hash *lh, uint key)
+void func_table_free(func_table *ft)
 {
-    uint pos = key % lh->max, i;
-    // first hit, this hash node is empty.
-    if(linear_hash_empty(lh, pos))
-        return linear_hash_val(lh, pos);
-
-    // try to find another empty node.
-    for(i = pos + 1; ; i++) {
-        if(i >= lh->max)
-            i = 0;
-        if(i == pos)
-            break;
-
-        if(linear_hash_empty(lh, i))
-            return linear_hash_val(lh, i);
-    }
-    return NULL;
+    if(ft == NULL)
+        return;
+    free(ft->node);
+    free(ft);
 }
 
-void linear_hash_remove(linear_hash *lh, uint key)
+// 0 marks empty node, so it is never a key hash.
+static uint func_table_hash(const char *key, uint *size)
 {
-    uchar* d = linear_hash_get(lh, key);
-    if(d == NULL)
-        return;
-    linear_hash_clear(lh, (d - lh->data) / lh->unit);
+    uint hash = string_hash_from(key);
+    *size = strlen(key);
+    return hash ? hash : 1;
 }
 
-string_hash* string_hash_alloc(uint unit, uint max)
+static func_node* func_table_find(func_table *ft, const char *key, uint hash, uint size)
 {
-    string_hash *sh = (string_hash *)
-        malloc(max * (unit + sizeof(uchar *)) + sizeof(string_hash));
-    if(sh == NULL)
-        return NULL;
-    memset(sh, 0, max * (unit + sizeof(uchar *)) + sizeof(string_hash));
-
-    sh->unit = unit + sizeof(uchar *);
-    sh->max = max;
-    return sh;
+    uint mask = ft->max - 1, i;
+    func_node *n;
+
+    for(i = hash & mask;; i = (i + 1) & mask) {
+        n = &ft->node[i];
+        if(n->hash == 0)
+            return n;       // miss, the node to insert.
+        if(n->hash == hash && n->size == size && memcmp(n->key, key, size) == 0)
+            return n;
+    }
 }
 
-uint string_hash_from(const char *str)
+void* func_table_get(func_table *ft, const char *key)
 {
-    uint hash = *str;
-    while(*str++)
-        hash = hash * 31 + *str;
-    return hash;
+    uint hash, size;
+    hash = func_table_hash(key, &size);
+    return func_table_find(ft, key, hash, size)->val;
 }
 
-uchar* string_hash_get(string_hash *sh, const char *key)
+/* node of the key, NULL if not found. */
+func_node* func_table_node(func_table *ft, const char *key)
 {
-    uint pos = (string_hash_from(key) % sh->max) * sh->unit, i;
-    // match node in the first hit.
-    if(strcmp(string_hash_key(sh, pos), key) == 0)
-        return string_hash_val(sh, pos);
+    uint hash, size;
+    func_node *n;
 
-    // try to hit next node if we miss the first.
-    for(i = pos + sh->unit;; i += sh->unit) {
-        if(i >= sh->unit * sh->max)
-            i = 0;
-        if(i == pos)
-            break;
-        if(strcmp(string_hash_key(sh, i), key) == 0)
-            return string_hash_val(sh, i);
-    }
-    return NULL;
+    hash = func_table_hash(key, &size);
+    n = func_table_find(ft, key, hash, size);
+    return n->hash ? n : NULL;
 }
 
-uchar* string_hash_set(string_hash *sh, const char *key, uchar *value)
+static int func_table_grow(func_table *ft)
 {
-    uint pos = (string_hash_from(key) % sh->max) * sh->unit, i;
-    // first hit, this hash node is empty.
-    if(string_hash_empty(sh, pos)) {
-        strcpy(string_hash_key(sh, pos), key);
-        memcpy(&string_hash_val(sh, pos), &value, sizeof(uchar *));
-        return string_hash_val(sh, pos);
-    }
+    func_node *old = ft->node, *n;
+    uint max = ft->max, i;
 
-    // try to find another empty node.
-    for(i = pos + sh->unit;; i += sh->unit) {
-        if(i >= sh->unit * sh->max)
-            i = 0;
-        if(i == pos)
-            break;
+    ft->node = (func_node *)calloc(max * 2, sizeof(func_node));
+    if(ft->node == NULL) {
+        ft->node = old;
+        return -1;
+    }
+    ft->max = max * 2;
+    for(i = 0; i < max; i++) {
+        if(old[i].hash == 0)
+            continue;
+        n = func_table_find(ft, old[i].key, old[i].hash, old[i].size);
+        *n = old[i];
+    }
+    free(old);
+    return 0;
+}
 
-        if(string_hash_empty(sh, i)) {
-            strcpy(string_hash_key(sh, i), key);
-            memcpy(&string_hash_val(sh, i), &value, sizeof(uchar *));
-            return string_hash_val(sh, i);
-        }
+/* add or replace key, return < 0 if the key is too long or out of memory. */
+int func_table_set(func_table *ft, const char *key, void *val)
+{
+    uint hash, size;
+    func_node *n;
+
+    hash = func_table_hash(key, &size);
+    if(size == 0 || size >= FUNCTION_SIZE)
+        return -1;
+
+    // keep load factor under 3/4, probe chains stay short.
+    if((ft->count + 1) * 4 > ft->max * 3 && func_table_grow(ft) < 0)
+        return -1;
+
+    n = func_table_find(ft, key, hash, size);
+    if(n->hash == 0) {
+        n->hash = hash;
+        n->size = size;
+        memcpy(n->key, key, size + 1);
+        ft->count++;
     }
-    return NULL;
+    n->val = val;
+    return 0;
 }
 
-void string_hash_remove(string_hash *sh, const char *key)
+void func_table_remove(func_table *ft, const char *key)
 {
-    uint pos = (string_hash_from(key) % sh->max) * sh->unit, i;
-    // match node in the first hit.
-    if(strcmp(string_hash_key(sh, pos), key) == 0) {
-        string_hash_clear(sh, pos);
+    uint mask = ft->max - 1, hash, size, i, j, home;
+    func_node *n;
+
+    hash = func_table_hash(key, &size);
+    n = func_table_find(ft, key, hash, size);
+    if(n->hash == 0)
         return;
-    }
 
-    // try to hit next node if we miss the first.
-    for(i = pos + sh->unit;; i += sh->unit) {
-        if(i >= sh->unit * sh->max)
-            i = 0;
-        if(i == pos)
-            break;
-        if(strcmp(string_hash_key(sh, i), key) == 0) {
-            string_hash_clear(sh, i);
-            return;
+    // backward shift, move every following node which may sit in the hole.
+    i = n - ft->node;
+    for(j = (i + 1) & mask; ft->node[j].hash; j = (j + 1) & mask) {
+        home = ft->node[j].hash & mask;
+        if(((j - home) & mask) >= ((j - i) & mask)) {
+            ft->node[i] = ft->node[j];
+            i = j;
         }
     }
+    memset(&ft->node[i], 0, sizeof(func_node));
+    ft->count--;
 }
 
-#define DATETIME_SIZE       32
-#define MIME_TYPE_SIZE      48
-#define LINEAR_HASH_NULL    ((uint)(-1))
+#define CACHE_NONE          "no-cache"
+#define CACHE_DAY           "max-age=86400"
+#define CACHE_WEEK          "max-age=604800"
 
 typedef struct _mime_node {
     const char *key;
     const char *type;
+    const char *cache;      // Cache-Control of static file response.
 }mime_node;
 
 static mime_node mime_nodes[] = {
-    { "html", "text/html" },
-    { "css", "text/css" },
-    { "js", "application/x-javascript" },
-    { "json", "application/json" },
-    { "gif", "image/gif" },
-    { "jpg", "image/jpeg" },
-    { "png", "image/png" },
-    { "ico", "image/vnd.microsoft.icon" },
-    { "txt", "text/plain"},
-    { "swf", "application/x-shockwave-flash" },
-    { "exe", "application/binary" },
-    { "gz", "application/gzip" },
-    { "pdf", "application/pdf" },
-    { "rtf", "application/rtf" },
-    { "zip", "application/zip" },
-    { "wav", "audio/x-wav" },
-    { "jpeg", "image/jpeg" },
-    { "tiff", "image/tiff" },
-    { "mov", "video/quicktime" },
-    { "mp4", "video/mp4" },
-    { "avi", "video/x-msvideo" },
-    { "xml", "text/xml" },
+    { "html", "text/html", CACHE_NONE },
+    { "css", "text/css", CACHE_DAY },
+    { "js", "application/x-javascript", CACHE_DAY },
+    { "json", "application/json", CACHE_NONE },
+    { "gif", "image/gif", CACHE_WEEK },
+    { "jpg", "image/jpeg", CACHE_WEEK },
+    { "png", "image/png", CACHE_WEEK },
+    { "ico", "image/vnd.microsoft.icon", CACHE_WEEK },
+    { "txt", "text/plain", CACHE_NONE },
+    { "swf", "application/x-shockwave-flash", CACHE_WEEK },
+    { "exe", "application/binary", CACHE_NONE },
+    { "gz", "application/gzip", CACHE_NONE },
+    { "pdf", "application/pdf", CACHE_DAY },
+    { "rtf", "application/rtf", CACHE_DAY },
+    { "zip", "application/zip", CACHE_NONE },
+    { "wav", "audio/x-wav", CACHE_WEEK },
+    { "jpeg", "image/jpeg", CACHE_WEEK },
+    { "tiff", "image/tiff", CACHE_WEEK },
+    { "mov", "video/quicktime", CACHE_WEEK },
+    { "mp4", "video/mp4", CACHE_WEEK },
+    { "avi", "video/x-msvideo", CACHE_WEEK },
+    { "xml", "text/xml", CACHE_NONE },
+    { "woff", "application/font-woff", CACHE_WEEK },
 };
 
+// unknown extend name, never compressed.
+static mime_node mime_unknown = { "", "application/octet-stream", CACHE_DAY };
+
 /* check str->size to make sure buffer is enough for the string */
 char* string_reference_dup(string_reference *str, char *buf)
 {
@@ -209,85 +211,351 @@ char* string_reference_dup(string_reference *str, char *buf)
     return buf;
 }
 
-// input: 4byte extend file name, such as txt, wav, html ... etc.
-const char *vohttpd_mime_map(const char *ext)
+const char *vohttpd_file_extend(const char *path)
+{
+    const char *p = strrchr(path, '.');
+    return p == NULL ? p : (p + 1);
+}
+
+static mime_node* vohttpd_mime_node(const char *ext)
 {
-    uint i, len;
+    uint i;
     if(ext == NULL)
-        return mime_nodes->type;
+        return &mime_unknown;
 
-    len = strlen(ext);
     for(i = 0; i < sizeof(mime_nodes) / sizeof(mime_node); i++) {
-        if(memcmp(ext, mime_nodes[i].key, len))
+        if(strcasecmp(ext, mime_nodes[i].key))
             continue;
-        return mime_nodes[i].type;
+        return &mime_nodes[i];
     }
-    return mime_nodes->type;
+    return &mime_unknown;
 }
 
-const char *vohttpd_code_message(int code)
+// input: 4byte extend file name, such as txt, wav, html ... etc.
+const char *vohttpd_mime_map(const char *ext)
+{
+    return vohttpd_mime_node(ext)->type;
+}
+
+// Cache-Control policy of static file by its extend name.
+const char *vohttpd_cache_control(const char *ext)
+{
+    return vohttpd_mime_node(ext)->cache;
+}
+
+/* status line and Server header of every code are built at compile time,
+ * a reply head only needs one memcpy.
+ */
+#define STATUS_NODE(code, msg) { code, msg, "HTTP/1.1 " #code " " msg "\r\n" \
+    "Server: " VOHTTPD_NAME "\r\n", sizeof("HTTP/1.1 " #code " " msg "\r\n" \
+    "Server: " VOHTTPD_NAME "\r\n") - 1 }
+
+static const struct {
+    int         code;
+    const char* msg;
+    const char* line;
+    int         size;
+} status_nodes[] = {
+    STATUS_NODE(200, "OK"),
+    STATUS_NODE(206, "Partial Content"),
+    STATUS_NODE(304, "Not Modified"),
+    STATUS_NODE(400, "Bad Request"),
+    STATUS_NODE(403, "Forbidden"),
+    STATUS_NODE(404, "Not Found"),
+    STATUS_NODE(405, "Access Denied"),
+    STATUS_NODE(408, "Request Timeout"),
+    STATUS_NODE(413, "Request too large"),
+    STATUS_NODE(416, "Range Not Satisfiable"),
+    STATUS_NODE(431, "Request Header Fields Too Large"),
+    STATUS_NODE(500, "Internal Server Error"),
+    STATUS_NODE(501, "Not Implemented"),
+    STATUS_NODE(502, "Bad Gateway"),
+    STATUS_NODE(503, "Service Unavailable"),
+    STATUS_NODE(504, "Gateway Timeout"),
+};
+
+static int vohttpd_status_node(int code)
 {
-    switch(code) {
-    case 200:
-        return "OK";
-    case 403:
-        return "Forbidden";
-    case 404:
-        return "Not Found";
-    case 405:
-        return "Access Denied";
-    case 413:
-        return "Request too large";
-    case 501:
-        return "Not Implemented";
-    default:
-        return "Unknown";
+    uint i;
+    for(i = 0; i < sizeof(status_nodes) / sizeof(status_nodes[0]); i++) {
+        if(status_nodes[i].code == code)
+            return (int)i;
     }
+    return -1;
+}
+
+const char *vohttpd_code_message(int code)
+{
+    int i = vohttpd_status_node(code);
+    return i < 0 ? "Unknown" : status_nodes[i].msg;
 }
 
 int vohttpd_reply_head(char *d, int code)
 {
-    int size = 0;
-    size += sprintf(d + size, "HTTP/1.1 %d %s\r\n", code, vohttpd_code_message(code));
-    size += sprintf(d + size, "Server: " VOHTTPD_NAME "\r\n");
+    int i = vohttpd_status_node(code);
+    if(i < 0)
+        return sprintf(d, "HTTP/1.1 %d Unknown\r\nServer: " VOHTTPD_NAME "\r\n", code);
+    memcpy(d, status_nodes[i].line, status_nodes[i].size + 1);
+    return status_nodes[i].size;
+}
+
+/* decimal digits of v to buf(no ending zero), return the length. */
+int vohttpd_itoa(char *buf, unsigned long long v)
+{
+    static const char digits[] =
+        "0001020304050607080910111213141516171819"
+        "2021222324252627282930313233343536373839"
+        "4041424344454647484950515253545556575859"
+        "6061626364656667686970717273747576777879"
+        "8081828384858687888990919293949596979899";
+    char tmp[24], *p = tmp + sizeof(tmp);
+    int size;
+
+    while(v >= 100) {
+        uint i = (uint)(v % 100) * 2;
+        v /= 100;
+        *--p = digits[i + 1];
+        *--p = digits[i];
+    }
+    if(v >= 10) {
+        *--p = digits[v * 2 + 1];
+        *--p = digits[v * 2];
+    } else {
+        *--p = (char)('0' + v);
+    }
+    size = tmp + sizeof(tmp) - p;
+    memcpy(buf, p, size);
     return size;
 }
 
+// append "name: value\r\n" to buf, return its length.
+int vohttpd_head_line(char *buf, const char *name, const char *value)
+{
+    int n = strlen(name), v = strlen(value);
+    memcpy(buf, name, n);
+    buf[n++] = ':';
+    buf[n++] = ' ';
+    memcpy(buf + n, value, v);
+    n += v;
+    buf[n++] = '\r';
+    buf[n++] = '\n';
+    buf[n] = '\0';
+    return n;
+}
+
+// append "name: number\r\n" to buf, return its length.
+int vohttpd_head_number(char *buf, const char *name, unsigned long long value)
+{
+    int n = strlen(name);
+    memcpy(buf, name, n);
+    buf[n++] = ':';
+    buf[n++] = ' ';
+    n += vohttpd_itoa(buf + n, value);
+    buf[n++] = '\r';
+    buf[n++] = '\n';
+    buf[n] = '\0';
+    return n;
+}
+
+/* Date header value, thread safe. the string only changes once a second,
+ * plugins may call it for every response.
+ */
 const char *vohttpd_gmtime()
 {
-    static char out[DATETIME_SIZE];
+    static __thread char out[DATETIME_SIZE];
+    static __thread time_t last;
+    struct tm tm;
     time_t t;
-    struct tm * pt;
 
     t = time(NULL);
-    pt = gmtime(&t);
-    strftime(out, DATETIME_SIZE, "%a, %d %b %Y %H:%M:%S GMT", pt);
+    if(t != last) {
+        strftime(out, DATETIME_SIZE, "%a, %d %b %Y %H:%M:%S GMT", gmtime_r(&t, &tm));
+        last = t;
+    }
     return out;
 }
 
+// value of "Connection" response header for current request.
+const char *vohttpd_connection(socket_data *d)
+{
+    return d->keep ? "keep-alive" : "close";
+}
+
 // return only head parameters, do not contains data before function parameter.
 // for example: http://vonger.cn/cgi-bin/hello?sometext,and,ok,
 // it will return "sometext,and,ok"
 int vohttpd_uri_parameters(socket_data *d, string_reference *s)
 {
-    char *end, *p;
-    p = strstr(d->head, "\r\n");
-    if(p == NULL) {
+    if(d->req == NULL) {
         s->size = 0;
         return 0;
     }
+    *s = d->req->query;
+    return s->size;
+}
 
-    while(p != d->head) {
-        if(*p == '?') {
-            s->ref = p + 1;
+static const struct {
+    const char* name;
+    uint        method;
+} method_nodes[] = {
+    { "GET", HTTP_METHOD_GET },
+    { "HEAD", HTTP_METHOD_HEAD },
+    { "POST", HTTP_METHOD_POST },
+    { "PUT", HTTP_METHOD_PUT },
+    { "DELETE", HTTP_METHOD_DELETE },
+    { "OPTIONS", HTTP_METHOD_OPTIONS },
+};
+
+// same order as HTTP_HEADER_ID.
+static const char *header_nodes[HEADER_ID_COUNT] = {
+    "",
+    "Host",
+    HTTP_CONNECTION,
+    HTTP_CONTENT_LENGTH,
+    HTTP_CONTENT_TYPE,
+    HTTP_ACCEPT_ENCODING,
+    HTTP_RANGE,
+    HTTP_IF_RANGE,
+    HTTP_IF_NONE_MATCH,
+    HTTP_IF_MODIFIED_SINCE,
+};
+
+// header names are case insensitive, so is the hash.
+uint vohttpd_header_hash(const char *name, uint size)
+{
+    uint hash = 0, i;
+    for(i = 0; i < size; i++)
+        hash = hash * 31 + (uchar)(name[i] | 0x20);
+    return hash;
+}
+
+static uint vohttpd_header_lookup(uint hash, const char *name, uint size)
+{
+    static uint hashes[HEADER_ID_COUNT];
+    uint i;
+
+    if(hashes[HEADER_ID_COUNT - 1] == 0) {
+        for(i = 1; i < HEADER_ID_COUNT; i++)
+            hashes[i] = vohttpd_header_hash(header_nodes[i], strlen(header_nodes[i]));
+    }
+    for(i = 1; i < HEADER_ID_COUNT; i++) {
+        if(hashes[i] == hash && strlen(header_nodes[i]) == size &&
+           strncasecmp(header_nodes[i], name, size) == 0)
+            return i;
+    }
+    return HEADER_OTHER;
+}
+
+/* parse request line and header lines of head[0, size), size includes the
+ * empty line. nothing is copied, r only refers to the head.
+ * return 0 if success, 400 if the head is broken, 431 if too many headers.
+ */
+int vohttpd_parse_request(http_request *r, char *head, uint size)
+{
+    char *p = head, *e = head + size, *t, *l;
+    uint i;
+
+    memset(r, 0, sizeof(http_request) - sizeof(r->header));
+
+    // request line: METHOD SP target SP HTTP/1.x CRLF
+    l = memchr(p, '\n', e - p);
+    if(l == NULL || l == p || l[-1] != '\r')
+        return 400;
+    t = memchr(p, ' ', l - p);
+    if(t == NULL)
+        return 400;
+    for(i = 0; i < sizeof(method_nodes) / sizeof(method_nodes[0]); i++) {
+        if(strlen(method_nodes[i].name) == (uint)(t - p) &&
+           memcmp(method_nodes[i].name, p, t - p) == 0) {
+            r->method = method_nodes[i].method;
             break;
         }
-        if(*p == ' ')
-            end = p;
-        p--;
     }
-    s->size = end - p;
-    return s->size;
+
+    for(p = t; p < l && *p == ' '; p++);
+    for(t = l - 1; t > p && *t != ' '; t--);
+    if(t == p)
+        return 400;
+    if(l - 1 - (t + 1) == 8 && memcmp(t + 1, "HTTP/1.", 7) == 0)
+        r->version = 10 + (t[8] == '1');
+    else
+        return 400;
+
+    r->uri.ref = p;
+    for(r->uri.size = t - p; r->uri.size > 0 && p[r->uri.size - 1] == ' '; r->uri.size--);
+    r->path = r->uri;
+    t = memchr(p, '?', r->uri.size);
+    if(t) {
+        r->path.size = t - p;
+        r->query.ref = t + 1;
+        r->query.size = r->uri.size - r->path.size - 1;
+    } else {
+        r->query.ref = p + r->uri.size;
+    }
+    // origin form only, every later step takes the path as a file name.
+    if(r->path.size == 0 || *r->path.ref != '/')
+        return 400;
+
+    // header lines: name ":" OWS value OWS CRLF, until the empty line.
+    for(p = l + 1; p < e; p = l + 1) {
+        http_header *h;
+
+        l = memchr(p, '\n', e - p);
+        if(l == NULL || l == p || l[-1] != '\r')
+            return 400;
+        if(l - 1 == p)
+            break;      // the empty line.
+        t = memchr(p, ':', l - 1 - p);
+        if(t == NULL || t == p)
+            return 400;
+        if(r->count >= HEADER_COUNT)
+            return 431;
+
+        h = &r->header[r->count];
+        h->name.ref = p;
+        h->name.size = t - p;
+        for(t++; t < l - 1 && (*t == ' ' || *t == '\t'); t++);
+        h->value.ref = t;
+        for(h->value.size = l - 1 - t; h->value.size > 0 &&
+            (t[h->value.size - 1] == ' ' || t[h->value.size - 1] == '\t'); h->value.size--);
+
+        h->hash = vohttpd_header_hash(h->name.ref, h->name.size);
+        h->id = vohttpd_header_lookup(h->hash, h->name.ref, h->name.size);
+        r->count++;
+        if(h->id != HEADER_OTHER && r->index[h->id] == 0)
+            r->index[h->id] = (uchar)r->count;
+    }
+    return 0;
+}
+
+/* find common request header by HTTP_HEADER_ID, return 0 if not found. */
+int vohttpd_header_id(socket_data *d, uint id, string_reference *v)
+{
+    if(d->req == NULL || id == HEADER_OTHER || id >= HEADER_ID_COUNT ||
+       d->req->index[id] == 0)
+        return 0;
+    *v = d->req->header[d->req->index[id] - 1].value;
+    return 1;
+}
+
+/* find request header by name(case insensitive), return 0 if not found. */
+int vohttpd_header(socket_data *d, const char *name, string_reference *v)
+{
+    uint size = strlen(name), hash, i;
+    http_header *h;
+
+    if(d->req == NULL)
+        return 0;
+    hash = vohttpd_header_hash(name, size);
+    for(i = 0; i < d->req->count; i++) {
+        h = &d->req->header[i];
+        if(h->hash == hash && h->name.size == size &&
+           strncasecmp(h->name.ref, name, size) == 0) {
+            *v = h->value;
+            return 1;
+        }
+    }
+    return 0;
 }
 
 int vohttpd_uri_first_parameter(string_reference *s, string_reference *first)
@@ -306,3 +574,147 @@ int vohttpd_uri_first_parameter(string_reference *s, string_reference *first)
     return 0;
 }
 
+
+// memory from request arena, lives until the request is done.
+void* vohttpd_alloc(socket_data *d, uint size)
+{
+    return d->set->alloc(d, size);
+}
+
+// return < 0 if the request can not be suspended, see _httpd_suspend.
+int vohttpd_suspend(socket_data *d, int fd, uint events, uint secs, _async_func func)
+{
+    return d->set->suspend(d, fd, events, secs, func);
+}
+
+void vohttpd_response_init(http_response *r, socket_data *d, int code)
+{
+    r->d = d;
+    r->code = code;
+    r->error = 0;
+    r->data = NULL;
+    r->size = 0;
+    r->used = 0;
+    r->count = 0;
+    r->length = 0;
+    r->head = vohttpd_reply_head(r->buf, code);
+}
+
+int vohttpd_response_header(http_response *r, const char *name, const char *value)
+{
+    if(r->head + strlen(name) + strlen(value) + 5 > sizeof(r->buf)) {
+        r->error = 1;
+        return -1;
+    }
+    r->head += vohttpd_head_line(r->buf + r->head, name, value);
+    return 0;
+}
+
+// add a body segment, extend the last one if they are continuous.
+static int vohttpd_response_segment(http_response *r, const char *data, uint size)
+{
+    struct iovec *v = &r->iov[r->count];
+
+    if(size == 0)
+        return 0;
+    if(r->count > 0 && (char *)v->iov_base + v->iov_len == data) {
+        v->iov_len += size;
+    } else {
+        if(r->count + 1 >= SENDV_COUNT) {
+            r->error = 1;
+            return -1;
+        }
+        v = &r->iov[++r->count];
+        v->iov_base = (void *)data;
+        v->iov_len = size;
+    }
+    r->length += size;
+    return 0;
+}
+
+/* make sure data block has room for size bytes, a new block is at least
+ * twice as large as the last one, so segments stay few.
+ */
+static int vohttpd_response_room(http_response *r, uint size)
+{
+    uint block;
+
+    if(r->used + size <= r->size)
+        return 0;
+    block = max(max(r->size * 2, SENDBUF_SIZE), size);
+    r->data = (char *)vohttpd_alloc(r->d, block);
+    if(r->data == NULL) {
+        r->error = 1;
+        return -1;
+    }
+    r->size = block;
+    r->used = 0;
+    return 0;
+}
+
+int vohttpd_response_write(http_response *r, const void *data, uint size)
+{
+    if(vohttpd_response_room(r, size) < 0)
+        return -1;
+    memcpy(r->data + r->used, data, size);
+    r->used += size;
+    return vohttpd_response_segment(r, r->data + r->used - size, size);
+}
+
+int vohttpd_response_printf(http_response *r, const char *format, ...)
+{
+    va_list ap;
+    int size;
+
+    va_start(ap, format);
+    size = vsnprintf(r->data ? r->data + r->used : NULL, r->size - r->used, format, ap);
+    va_end(ap);
+    if(size < 0) {
+        r->error = 1;
+        return -1;
+    }
+
+    // not enough room, format again in a larger block.
+    if(r->used + size >= r->size) {
+        if(vohttpd_response_room(r, size + 1) < 0)
+            return -1;
+        va_start(ap, format);
+        vsnprintf(r->data + r->used, r->size - r->used, format, ap);
+        va_end(ap);
+    }
+    r->used += size;
+    return vohttpd_response_segment(r, r->data + r->used - size, size);
+}
+
+int vohttpd_response_ref(http_response *r, const void *data, uint size)
+{
+    return vohttpd_response_segment(r, (const char *)data, size);
+}
+
+/* finish the head and send everything in one call.
+ * return sent size, < 0 if failed.
+ */
+int vohttpd_response_send(http_response *r)
+{
+    socket_data *d = r->d;
+    int ret;
+
+    if(r->error)
+        return d->set->error_page(d, 500, "response is too large or out of memory.");
+
+    // Content-Length, Date, Connection and the empty line, at most 128 bytes.
+    if(r->head + MESSAGE_SIZE / 2 > sizeof(r->buf))
+        return d->set->error_page(d, 500, "response head is too large.");
+    r->head += vohttpd_head_number(r->buf + r->head, HTTP_CONTENT_LENGTH, r->length);
+    r->head += vohttpd_head_line(r->buf + r->head, HTTP_DATE_TIME, vohttpd_date_value(d->set));
+    r->head += vohttpd_head_line(r->buf + r->head, HTTP_CONNECTION, vohttpd_connection(d));
+    r->buf[r->head++] = '\r';
+    r->buf[r->head++] = '\n';
+
+    r->iov[0].iov_base = r->buf;
+    r->iov[0].iov_len = r->head;
+    ret = d->set->sendv(d->sock, r->iov, r->count + 1, 0);
+    if(ret < (int)(r->head + r->length))
+        d->keep = 0;    // the client can not get the full response.
+    return ret;
+}
@@ -0,0 +1,198 @@
+/* vohttpdpool: thread pool for plugin functions which block.
+ *
+ * author: Qin Wei(me@vonger.cn)
+ * compile: cc -c vohttpdpool.c -o vohttpdpool.o
+ *
+ * the loop submits jobs to a bounded lock-free ring, idle threads sleep on
+ * a semaphore. finished jobs are pushed to a lock-free stack and the loop
+ * is woken by the pool fd(eventfd on linux), it takes them all at once.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <semaphore.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
+#include "vohttpd.h"
+
+typedef struct _pool_slot {
+    uint        seq;        // ticket the slot waits for.
+    thread_job* job;
+} pool_slot;
+
+struct _thread_pool {
+    int         fd[2];      // [0] loop waits on it, [1] threads write to it.
+    uint        count;      // thread count.
+    uint        mask;       // slot count - 1.
+    uint        stop;
+
+    uint        head;       // next ticket to submit, loop only.
+    uint        tail;       // next ticket to run, threads take it by CAS.
+    thread_job* done;       // finished jobs, newest first.
+    sem_t       ready;      // submitted jobs not taken yet.
+
+    pthread_t*  thread;
+    pool_slot   slot[1];
+};
+
+/* take the next job, the ticket is taken by CAS so each job runs once. */
+static thread_job* thread_pool_take(thread_pool *tp)
+{
+    uint pos = __atomic_load_n(&tp->tail, __ATOMIC_RELAXED), seq;
+    pool_slot *s;
+    thread_job *job;
+
+    while(1) {
+        s = &tp->slot[pos & tp->mask];
+        seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+        if((int)(seq - (pos + 1)) < 0)
+            return NULL;        // empty.
+        if(seq == pos + 1 && __atomic_compare_exchange_n(&tp->tail, &pos, pos + 1,
+                0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            break;
+        if(seq != pos + 1)
+            pos = __atomic_load_n(&tp->tail, __ATOMIC_RELAXED);
+    }
+
+    job = s->job;
+    // slot is free for the ticket one round later.
+    __atomic_store_n(&s->seq, pos + tp->mask + 1, __ATOMIC_RELEASE);
+    return job;
+}
+
+static void* thread_pool_main(void *arg)
+{
+    thread_pool *tp = (thread_pool *)arg;
+    thread_job *job;
+    uint64_t one = 1;
+
+    while(1) {
+        while(sem_wait(&tp->ready) < 0 && errno == EINTR);
+        if(__atomic_load_n(&tp->stop, __ATOMIC_ACQUIRE))
+            break;
+        job = thread_pool_take(tp);
+        if(job == NULL)
+            continue;
+
+        job->run(job);
+
+        // push to done stack, wake the loop if it was empty.
+        job->next = __atomic_load_n(&tp->done, __ATOMIC_RELAXED);
+        while(!__atomic_compare_exchange_n(&tp->done, &job->next, job,
+                0, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+        if(job->next == NULL)
+            write(tp->fd[1], &one, sizeof(one));
+    }
+    return NULL;
+}
+
+/* threads: thread count, size: max queued jobs, rounded up to power of 2. */
+thread_pool* thread_pool_alloc(uint threads, uint size)
+{
+    thread_pool *tp;
+    uint i, n;
+
+    for(n = 1; n < size; n <<= 1);
+    tp = (thread_pool *)calloc(1, sizeof(thread_pool) + n * sizeof(pool_slot));
+    if(tp == NULL)
+        return NULL;
+    tp->mask = n - 1;
+    for(i = 0; i < n; i++)
+        tp->slot[i].seq = i;
+
+#ifdef __linux__
+    tp->fd[0] = tp->fd[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(tp->fd[0] < 0) {
+#else
+    if(pipe(tp->fd) < 0) {
+#endif
+        free(tp);
+        return NULL;
+    }
+    fcntl(tp->fd[0], F_SETFL, fcntl(tp->fd[0], F_GETFL) | O_NONBLOCK);
+
+    if(sem_init(&tp->ready, 0, 0) < 0) {
+        close(tp->fd[0]);
+        if(tp->fd[1] != tp->fd[0])
+            close(tp->fd[1]);
+        free(tp);
+        return NULL;
+    }
+    tp->thread = (pthread_t *)malloc(threads * sizeof(pthread_t));
+    if(tp->thread == NULL) {
+        thread_pool_free(tp);
+        return NULL;
+    }
+    for(tp->count = 0; tp->count < threads; tp->count++) {
+        if(pthread_create(&tp->thread[tp->count], NULL, thread_pool_main, tp) != 0)
+            break;
+    }
+    if(tp->count == 0) {
+        thread_pool_free(tp);
+        return NULL;
+    }
+    return tp;
+}
+
+/* stop threads after their current job, jobs not taken are dropped. */
+void thread_pool_free(thread_pool *tp)
+{
+    uint i;
+
+    if(tp == NULL)
+        return;
+    __atomic_store_n(&tp->stop, 1, __ATOMIC_RELEASE);
+    for(i = 0; i < tp->count; i++)
+        sem_post(&tp->ready);
+    for(i = 0; i < tp->count; i++)
+        pthread_join(tp->thread[i], NULL);
+
+    sem_destroy(&tp->ready);
+    close(tp->fd[0]);
+    if(tp->fd[1] != tp->fd[0])
+        close(tp->fd[1]);
+    free(tp->thread);
+    free(tp);
+}
+
+int thread_pool_fd(thread_pool *tp)
+{
+    return tp->fd[0];
+}
+
+/* loop only. return < 0 if the queue is full. */
+int thread_pool_submit(thread_pool *tp, thread_job *job)
+{
+    pool_slot *s = &tp->slot[tp->head & tp->mask];
+
+    if(__atomic_load_n(&s->seq, __ATOMIC_ACQUIRE) != tp->head)
+        return -1;  // a thread has not taken the job of last round yet.
+    s->job = job;
+    __atomic_store_n(&s->seq, tp->head + 1, __ATOMIC_RELEASE);
+    tp->head++;
+    sem_post(&tp->ready);
+    return 0;
+}
+
+/* loop only, take all finished jobs in the order they finished. */
+thread_job* thread_pool_done(thread_pool *tp)
+{
+    thread_job *list, *next, *prev = NULL;
+    uint64_t n;
+
+    while(read(tp->fd[0], &n, sizeof(n)) > 0);
+    list = __atomic_exchange_n(&tp->done, NULL, __ATOMIC_ACQUIRE);
+    for(; list; list = next) {
+        next = list->next;
+        list->next = prev;
+        prev = list;
+    }
+    return prev;
+}
@@ -0,0 +1,117 @@
+/* vohttpdtimer: hierarchical timer wheel for connection deadlines.
+ *
+ * author: Qin Wei(me@vonger.cn)
+ * compile: cc -c vohttpdtimer.c -o vohttpdtimer.o
+ *
+ * tick is one second. level 0 holds timers due in the next TIMER_SLOTS
+ * ticks, level 1 the ones after that, they move down when level 0 wraps.
+ * add, delete and expire of each timer are O(1).
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "vohttpd.h"
+
+#define TIMER_MASK      (TIMER_SLOTS - 1)
+#define TIMER_BITS      6       // log2(TIMER_SLOTS)
+
+static void timer_list_init(timer_node *head)
+{
+    head->next = head->prev = head;
+}
+
+timer_wheel* timer_wheel_alloc(uint now)
+{
+    timer_wheel *tw;
+    uint i, j;
+
+    tw = (timer_wheel *)malloc(sizeof(timer_wheel));
+    if(tw == NULL)
+        return NULL;
+
+    for(i = 0; i < TIMER_LEVELS; i++) {
+        for(j = 0; j < TIMER_SLOTS; j++)
+            timer_list_init(&tw->slot[i][j]);
+    }
+    tw->now = now;
+    return tw;
+}
+
+void timer_wheel_free(timer_wheel *tw)
+{
+    free(tw);
+}
+
+void timer_del(timer_node *n)
+{
+    if(n->next == NULL)
+        return;
+    n->prev->next = n->next;
+    n->next->prev = n->prev;
+    n->next = n->prev = NULL;
+}
+
+static void timer_link(timer_wheel *tw, timer_node *n)
+{
+    uint delta = n->expire - tw->now;
+    timer_node *head;
+
+    if(delta < TIMER_SLOTS) {
+        head = &tw->slot[0][n->expire & TIMER_MASK];
+    } else {
+        // too far away, wait in the last round level 1 can reach.
+        if(delta >= TIMER_SLOTS * (TIMER_SLOTS - 1))
+            n->expire = tw->now + TIMER_SLOTS * (TIMER_SLOTS - 1);
+        head = &tw->slot[1][(n->expire >> TIMER_BITS) & TIMER_MASK];
+    }
+
+    n->prev = head->prev;
+    n->next = head;
+    head->prev->next = n;
+    head->prev = n;
+}
+
+/* (re)schedule the timer to expire at the given time(seconds). */
+void timer_add(timer_wheel *tw, timer_node *n, uint expire)
+{
+    timer_del(n);
+    // already passed, fire at next tick.
+    n->expire = (int)(expire - tw->now) > 0 ? expire : tw->now + 1;
+    timer_link(tw, n);
+}
+
+/* advance the wheel to now, call func for every expired timer.
+ * the timer is removed before func, func may add it again.
+ */
+void timer_expire(timer_wheel *tw, uint now, void (*func)(timer_node *))
+{
+    timer_node *head, *n, list;
+
+    while((int)(now - tw->now) > 0) {
+        tw->now++;
+
+        // level 0 wraps, move timers of next round down from level 1.
+        if((tw->now & TIMER_MASK) == 0) {
+            head = &tw->slot[1][(tw->now >> TIMER_BITS) & TIMER_MASK];
+            if(head->next != head) {
+                list = *head;
+                list.next->prev = &list;
+                list.prev->next = &list;
+                timer_list_init(head);
+                while(list.next != &list) {
+                    n = list.next;
+                    timer_del(n);
+                    timer_link(tw, n);
+                }
+            }
+        }
+
+        head = &tw->slot[0][tw->now & TIMER_MASK];
+        while(head->next != head) {
+            n = head->next;
+            timer_del(n);
+            func(n);
+        }
+    }
+}
@@ -7,6 +7,11 @@ CONFIG  -= app_bundle
 HEADERS += src/vohttpd.h
 SOURCES += src/vohttpd.c \
            src/vohttpdext.c \
+           src/vohttpdevent.c \
+           src/vohttpdcache.c \
+           src/vohttpdtimer.c \
+           src/vohttpdpool.c
+
 OTHER_FILES += \
             src/plugins/voplugin.c \
             src/plugins/votest.c